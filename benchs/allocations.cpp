@@ -0,0 +1,114 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tree.hpp"
+
+namespace {
+size_t allocations = 0;
+} // namespace
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+namespace {
+using Clock = std::chrono::steady_clock;
+using Tree = trees::AVLtree<std::string, std::less<>>;
+
+// Keys are longer than the small string buffer, so every copy allocates.
+std::vector<std::string> make_keys(int count) {
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (int i = 0; i < count; i++)
+        keys.push_back("key-of-a-long-record-" + std::to_string(i * 7919));
+    return keys;
+}
+
+template <typename FuncT> void report(const char *name, int ops, FuncT func) {
+    size_t before = allocations;
+    auto start = Clock::now();
+    func();
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start)
+                    .count();
+
+    std::cout << name << ": "
+              << static_cast<double>(allocations - before) / ops
+              << " allocations, " << ns / ops << " ns per operation"
+              << std::endl;
+}
+} // namespace
+
+int main() {
+    const int count = 1 << 18;
+    const auto keys = make_keys(count);
+    volatile size_t sink = 0;
+
+    {
+        Tree tree;
+        report("insert(const KeyT &)", count, [&] {
+            for (auto &key : keys)
+                tree.insert(key);
+        });
+    }
+
+    {
+        Tree tree;
+        auto moved = keys;
+        report("insert(KeyT &&)", count, [&] {
+            for (auto &key : moved)
+                tree.insert(std::move(key));
+        });
+    }
+
+    {
+        Tree tree;
+        report("emplace(const char *, size)", count, [&] {
+            for (auto &key : keys)
+                tree.emplace(key.data(), key.size());
+        });
+    }
+
+    {
+        std::set<std::string, std::less<>> set;
+        report("std::set emplace(const char *, size)", count, [&] {
+            for (auto &key : keys)
+                set.emplace(key.data(), key.size());
+        });
+    }
+
+    Tree tree{keys.begin(), keys.end()};
+
+    report("find(std::string_view)", count, [&] {
+        for (auto &key : keys)
+            sink = sink + (tree.find(std::string_view{key}) != tree.end());
+    });
+
+    report("dereference while iterating", count, [&] {
+        const Tree &view = tree;
+        for (auto it = view.begin(); it != view.end(); ++it)
+            sink = sink + (*it).size();
+    });
+
+    report("extract, change key, insert", count, [&] {
+        for (auto &key : keys) {
+            auto handle = tree.extract(std::string_view{key});
+            handle.key()[0] = 'K';
+            tree.insert(std::move(handle));
+        }
+    });
+
+    return 0;
+}
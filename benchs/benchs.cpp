@@ -1,14 +1,29 @@
 #include <cassert>
 #include <iostream>
+#include <map>
+#include <memory_resource>
 #include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "hayai.hpp"
 #include "hayai_main.hpp"
+#include "compact_tree.hpp"
+#include "fast_input.hpp"
+#include "frozen_index.hpp"
+#include "map.hpp"
+#include "multiset.hpp"
+#include "packed_tree.hpp"
+#include "parallel_queries.hpp"
+#include "persistent_tree.hpp"
 #include "process_queries.hpp"
 #include "tree.hpp"
 
 std::vector<query::Query<int>> queries;
+std::vector<int> keys;
+volatile size_t sink = 0;
 
 BENCHMARK(NumKeysFromDiapason, BenchOurTree, 1, 1) {
     trees::AVLtree<int> tree;
@@ -21,6 +36,20 @@ BENCHMARK(NumKeysFromDiapason, BenchOurTree, 1, 1) {
         query::get_answers<int>(tree, queries.begin(), queries.end(), distance);
 }
 
+BENCHMARK(NumKeysFromDiapason, BenchOurTreeBatched, 1, 1) {
+    trees::AVLtree<int> tree;
+
+    std::vector<size_t> answer_tree = query::get_answers<int>(
+        tree, queries.begin(), queries.end(), query::RangeCount{});
+}
+
+BENCHMARK(NumKeysFromDiapason, BenchOurMultiset, 1, 1) {
+    trees::AVLmultiset<int> tree;
+
+    std::vector<size_t> answer_tree = query::get_answers<int>(
+        tree, queries.begin(), queries.end(), query::RangeCount{});
+}
+
 BENCHMARK(NumKeysFromDiapason, BenchSet, 1, 1) {
     std::set<int> tree;
 
@@ -32,6 +61,629 @@ BENCHMARK(NumKeysFromDiapason, BenchSet, 1, 1) {
         query::get_answers<int>(tree, queries.begin(), queries.end(), distance);
 }
 
+template <template <typename> class Storage>
+using StorageTree = trees::AVLtree<int, std::less<int>, Storage>;
+
+BENCHMARK(InsertAllocation, BenchArena, 10, 1) {
+    StorageTree<trees::details::ArenaStorage> tree;
+    for (auto key : keys)
+        tree.insert(key);
+}
+
+BENCHMARK(InsertAllocation, BenchHeap, 10, 1) {
+    StorageTree<trees::details::HeapStorage> tree;
+    for (auto key : keys)
+        tree.insert(key);
+}
+
+BENCHMARK(InsertAllocation, BenchArenaMonotonicResource, 10, 1) {
+    std::pmr::monotonic_buffer_resource resource;
+    StorageTree<trees::details::ArenaStorage> tree{&resource};
+    for (auto key : keys)
+        tree.insert(key);
+}
+
+BENCHMARK(InsertAllocation, BenchSet, 10, 1) {
+    std::set<int> tree;
+    for (auto key : keys)
+        tree.insert(key);
+}
+
+template <typename TreeT> TreeT make_sequential_tree(int size) {
+    TreeT tree;
+    for (int i = 0; i < size; i++)
+        tree.insert(i * 2);
+    return tree;
+}
+
+template <typename TreeT> size_t run_lookups(const TreeT &tree, int size) {
+    size_t found = 0;
+    for (int i = 0; i < 100000; i++) {
+        int key = (i * 7919) % (2 * size);
+        found += tree.lower_bound(key) != tree.end();
+        found += tree.upper_bound(key) != tree.end();
+        found += tree.find(key) != tree.end();
+    }
+    return found;
+}
+
+const auto small_tree = make_sequential_tree<trees::AVLtree<int>>(1 << 10);
+const auto small_set = make_sequential_tree<std::set<int>>(1 << 10);
+const auto large_tree = make_sequential_tree<trees::AVLtree<int>>(1 << 20);
+const auto large_set = make_sequential_tree<std::set<int>>(1 << 20);
+
+BENCHMARK(Lookup, BenchOurTreeSmall, 10, 1) {
+    sink = sink + run_lookups(small_tree, 1 << 10);
+}
+
+BENCHMARK(Lookup, BenchSetSmall, 10, 1) {
+    sink = sink + run_lookups(small_set, 1 << 10);
+}
+
+BENCHMARK(Lookup, BenchOurTreeLarge, 10, 1) {
+    sink = sink + run_lookups(large_tree, 1 << 20);
+}
+
+BENCHMARK(Lookup, BenchSetLarge, 10, 1) {
+    sink = sink + run_lookups(large_set, 1 << 20);
+}
+
+BENCHMARK(OrderStatistics, BenchOurTree, 3, 1) {
+    size_t total = 0;
+    for (size_t i = 0; i < 100; i++) {
+        auto key = large_tree.select(large_tree.size() * i / 100);
+        total += large_tree.rank(key);
+    }
+    sink = sink + total;
+}
+
+BENCHMARK(OrderStatistics, BenchSet, 3, 1) {
+    size_t total = 0;
+    for (size_t i = 0; i < 100; i++) {
+        auto key = *std::next(large_set.begin(), large_set.size() * i / 100);
+        total += std::distance(large_set.begin(), large_set.lower_bound(key));
+    }
+    sink = sink + total;
+}
+
+const auto sorted_keys = [] {
+    std::vector<int> keys(1 << 20);
+    for (int i = 0; i < (1 << 20); i++)
+        keys[i] = i * 2;
+    return keys;
+}();
+
+BENCHMARK(WarmUp, BenchBulkBuild, 10, 1) {
+    trees::AVLtree<int> tree(sorted_keys.begin(), sorted_keys.end());
+    sink = sink + tree.size();
+}
+
+BENCHMARK(WarmUp, BenchInsertLoop, 10, 1) {
+    trees::AVLtree<int> tree;
+    for (auto key : sorted_keys)
+        tree.insert(key);
+    sink = sink + tree.size();
+}
+
+BENCHMARK(WarmUp, BenchSet, 10, 1) {
+    std::set<int> tree(sorted_keys.begin(), sorted_keys.end());
+    sink = sink + tree.size();
+}
+
+BENCHMARK(NumKeysFromDiapason, BenchCompactTree, 1, 1) {
+    trees::CompactAVLtree<int> tree;
+
+    auto distance = [](trees::CompactAVLtree<int> &tree, int key1, int key2) {
+        return tree.get_num_elems_from_diapason(key1, key2);
+    };
+
+    std::vector<size_t> answer_tree =
+        query::get_answers<int>(tree, queries.begin(), queries.end(), distance);
+}
+
+const auto large_compact = make_sequential_tree<trees::CompactAVLtree<int>>(1 << 20);
+
+BENCHMARK(Lookup, BenchCompactTreeLarge, 10, 1) {
+    size_t found = 0;
+    for (int i = 0; i < 100000; i++) {
+        int key = (i * 7919) % (2 << 20);
+        found += large_compact.lower_bound(key) != large_compact.end();
+        found += large_compact.contains(key);
+    }
+    sink = sink + found;
+}
+
+const auto string_keys = [] {
+    std::vector<std::string> keys;
+    for (int i = 0; i < 100000; i++)
+        keys.push_back("some-long-string-key-prefix/" + std::to_string(i * 7));
+    return keys;
+}();
+
+const auto string_probes = [] {
+    std::vector<std::string_view> probes;
+    for (int i = 0; i < 100000; i++)
+        probes.push_back(string_keys[(i * 7919) % string_keys.size()]);
+    return probes;
+}();
+
+template <typename TreeT> TreeT make_string_tree() {
+    TreeT tree;
+    for (auto &key : string_keys)
+        tree.insert(key);
+    return tree;
+}
+
+const auto string_tree =
+    make_string_tree<trees::AVLtree<std::string, std::less<>>>();
+const auto string_tree_opaque = make_string_tree<trees::AVLtree<std::string>>();
+const auto string_set = make_string_tree<std::set<std::string, std::less<>>>();
+
+BENCHMARK(StringLookup, BenchOurTreeTransparent, 10, 1) {
+    size_t found = 0;
+    for (auto probe : string_probes)
+        found += string_tree.contains(probe);
+    sink = sink + found;
+}
+
+BENCHMARK(StringLookup, BenchOurTreeTemporaryKey, 10, 1) {
+    size_t found = 0;
+    for (auto probe : string_probes)
+        found += string_tree_opaque.contains(std::string{probe});
+    sink = sink + found;
+}
+
+BENCHMARK(StringLookup, BenchSetTransparent, 10, 1) {
+    size_t found = 0;
+    for (auto probe : string_probes)
+        found += string_set.contains(probe);
+    sink = sink + found;
+}
+
+BENCHMARK(StringInsert, BenchOurTree, 10, 1) {
+    auto tree = make_string_tree<trees::AVLtree<std::string, std::less<>>>();
+    sink = sink + tree.size();
+}
+
+BENCHMARK(StringInsert, BenchSet, 10, 1) {
+    auto tree = make_string_tree<std::set<std::string, std::less<>>>();
+    sink = sink + tree.size();
+}
+
+const auto large_ranges = [] {
+    std::vector<std::pair<int, int>> ranges;
+    for (int i = 0; i < 100000; i++) {
+        int lo = (i * 7919) % (2 << 20);
+        ranges.emplace_back(lo, lo + static_cast<int>((i * 104729LL) % 4096));
+    }
+    return ranges;
+}();
+
+BENCHMARK(RangeBatch, BenchSingleQueries, 10, 1) {
+    size_t total = 0;
+    for (auto [lo, hi] : large_ranges)
+        total += large_tree.get_num_elems_from_diapason(lo, hi);
+    sink = sink + total;
+}
+
+BENCHMARK(RangeBatch, BenchCountRanges, 10, 1) {
+    auto answers = large_tree.count_ranges(large_ranges);
+    sink = sink + answers.size();
+}
+
+// Random keys inserted in random order, so the nodes of the live tree are
+// spread over the arena; the ranges cover about 64 keys each.
+const auto random_keys = [] {
+    std::vector<int> keys;
+    for (int i = 0; i < (1 << 20); i++)
+        keys.push_back(static_cast<int>((i * 2654435761LL) % (1 << 30)));
+    return keys;
+}();
+
+const auto random_tree = [] {
+    trees::AVLtree<int> tree;
+    for (auto key : random_keys)
+        tree.insert(key);
+    return tree;
+}();
+
+const auto random_set = std::set<int>(random_keys.begin(), random_keys.end());
+const auto random_index = trees::freeze(random_tree);
+
+const auto random_ranges = [] {
+    std::vector<std::pair<int, int>> ranges;
+    for (int i = 0; i < 1000000; i++) {
+        int lo = static_cast<int>((i * 40503LL * 40503LL) % (1 << 30));
+        ranges.emplace_back(lo, lo + (1 << 16));
+    }
+    return ranges;
+}();
+
+BENCHMARK(FrozenRanges, BenchLiveTree, 10, 1) {
+    size_t total = 0;
+    for (auto [lo, hi] : random_ranges)
+        total += random_tree.get_num_elems_from_diapason(lo, hi);
+    sink = sink + total;
+}
+
+BENCHMARK(FrozenRanges, BenchFrozenIndex, 10, 1) {
+    size_t total = 0;
+    for (auto [lo, hi] : random_ranges)
+        total += random_index.get_num_elems_from_diapason(lo, hi);
+    sink = sink + total;
+}
+
+BENCHMARK(FrozenRanges, BenchSet, 3, 1) {
+    size_t total = 0;
+    for (auto [lo, hi] : random_ranges)
+        total += static_cast<size_t>(std::distance(random_set.lower_bound(lo),
+                                                   random_set.upper_bound(hi)));
+    sink = sink + total;
+}
+
+BENCHMARK(FrozenRanges, BenchFreeze, 10, 1) {
+    sink = sink + trees::freeze(random_tree).size();
+}
+
+// The same random keys in a packed tree, searched with each level of
+// vector instructions.
+const auto random_packed = [] {
+    trees::PackedTree<int> tree;
+    for (auto key : random_keys)
+        tree.insert(key);
+    return tree;
+}();
+
+template <typename TreeT> size_t count_random_ranges(const TreeT &tree) {
+    size_t total = 0;
+    for (auto [lo, hi] : random_ranges)
+        total += tree.get_num_elems_from_diapason(lo, hi);
+    return total;
+}
+
+template <typename TreeT> size_t find_random_keys(const TreeT &tree) {
+    size_t found = 0;
+    for (auto [lo, hi] : random_ranges)
+        found += tree.contains(lo) + tree.contains(random_keys[hi % random_keys.size()]);
+    return found;
+}
+
+BENCHMARK(PackedRanges, BenchOurTree, 10, 1) {
+    sink = sink + count_random_ranges(random_tree);
+}
+
+BENCHMARK(PackedRanges, BenchPackedAvx2, 10, 1) {
+    trees::simd::use(trees::simd::Level::avx2);
+    sink = sink + count_random_ranges(random_packed);
+}
+
+BENCHMARK(PackedRanges, BenchPackedSse2, 10, 1) {
+    trees::simd::use(trees::simd::Level::sse2);
+    sink = sink + count_random_ranges(random_packed);
+}
+
+BENCHMARK(PackedRanges, BenchPackedScalar, 10, 1) {
+    trees::simd::use(trees::simd::Level::scalar);
+    sink = sink + count_random_ranges(random_packed);
+}
+
+BENCHMARK(PackedLookup, BenchOurTree, 10, 1) {
+    sink = sink + find_random_keys(random_tree);
+}
+
+BENCHMARK(PackedLookup, BenchPackedAvx2, 10, 1) {
+    trees::simd::use(trees::simd::Level::avx2);
+    sink = sink + find_random_keys(random_packed);
+}
+
+BENCHMARK(PackedLookup, BenchPackedSse2, 10, 1) {
+    trees::simd::use(trees::simd::Level::sse2);
+    sink = sink + find_random_keys(random_packed);
+}
+
+BENCHMARK(PackedLookup, BenchPackedScalar, 10, 1) {
+    trees::simd::use(trees::simd::Level::scalar);
+    sink = sink + find_random_keys(random_packed);
+}
+
+BENCHMARK(PackedInsert, BenchOurTree, 3, 1) {
+    trees::AVLtree<int> tree;
+    for (auto key : random_keys)
+        tree.insert(key);
+    sink = sink + tree.size();
+}
+
+BENCHMARK(PackedInsert, BenchPackedAvx2, 3, 1) {
+    trees::simd::use(trees::simd::Level::avx2);
+    trees::PackedTree<int> tree;
+    for (auto key : random_keys)
+        tree.insert(key);
+    sink = sink + tree.size();
+}
+
+using SumTree = trees::AVLtree<int, std::less<int>, trees::details::ArenaStorage,
+                               trees::aggregates::Sum<long long>>;
+
+const auto large_sum_tree = make_sequential_tree<SumTree>(1 << 20);
+
+BENCHMARK(RangeAggregate, BenchIteratorWalk, 10, 1) {
+    long long total = 0;
+    for (auto [lo, hi] : large_ranges)
+        for (auto it = large_tree.lower_bound(lo);
+             it != large_tree.end() && *it <= hi; ++it)
+            total += *it;
+    sink = sink + static_cast<size_t>(total);
+}
+
+BENCHMARK(RangeAggregate, BenchAggregate, 10, 1) {
+    long long total = 0;
+    for (auto [lo, hi] : large_ranges)
+        total += large_sum_tree.aggregate(lo, hi);
+    sink = sink + static_cast<size_t>(total);
+}
+
+// Counts every key of the input, then looks each one up again.
+template <typename MapT> size_t count_keys(MapT &map) {
+    for (auto key : keys)
+        map[key]++;
+
+    size_t total = 0;
+    for (auto key : keys)
+        total += map.find(key)->second;
+    return total;
+}
+
+BENCHMARK(MapCounts, BenchOurMap, 10, 1) {
+    trees::AVLmap<int, size_t> map;
+    sink = sink + count_keys(map);
+}
+
+BENCHMARK(MapCounts, BenchStdMap, 10, 1) {
+    std::map<int, size_t> map;
+    sink = sink + count_keys(map);
+}
+
+BENCHMARK(MapCounts, BenchTreeAndHashMap, 10, 1) {
+    trees::AVLtree<int> tree;
+    std::unordered_map<int, size_t> values;
+    for (auto key : keys) {
+        tree.insert(key);
+        values[key]++;
+    }
+
+    size_t total = 0;
+    for (auto key : keys)
+        if (tree.contains(key))
+            total += values.find(key)->second;
+    sink = sink + total;
+}
+
+const auto large_persistent =
+    make_sequential_tree<trees::PersistentAVLtree<int>>(1 << 20);
+
+BENCHMARK(Snapshot, BenchFullCopy, 10, 1) {
+    trees::AVLtree<int> copy{large_tree};
+    sink = sink + copy.size();
+}
+
+BENCHMARK(Snapshot, BenchPersistent, 10, 1) {
+    auto snapshot = large_persistent.snapshot();
+    sink = sink + snapshot.size();
+}
+
+const trees::AVLtree<int> large_tree_copy{large_tree};
+const auto large_snapshot = large_persistent.snapshot();
+
+BENCHMARK(SnapshotQueries, BenchFullCopy, 10, 1) {
+    size_t total = 0;
+    for (auto [lo, hi] : large_ranges)
+        total += large_tree_copy.get_num_elems_from_diapason(lo, hi);
+    sink = sink + total;
+}
+
+BENCHMARK(SnapshotQueries, BenchPersistent, 10, 1) {
+    size_t total = 0;
+    for (auto [lo, hi] : large_ranges)
+        total += large_snapshot.get_num_elems_from_diapason(lo, hi);
+    sink = sink + total;
+}
+
+// Two shards that own the key ranges [0, 2^21) and [2^21, 2^22); every
+// iteration moves the top 2% of the first shard over the boundary and back.
+auto shard_a = make_sequential_tree<trees::AVLtree<int>>(1 << 20);
+auto shard_b = [] {
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < (1 << 20); i++)
+        tree.insert((2 << 20) + 2 * i);
+    return tree;
+}();
+
+const int migrated_lo = (2 << 20) - (2 << 20) / 50;
+const int migrated_hi = 2 << 20;
+
+void migrate_by_insert(trees::AVLtree<int> &from, trees::AVLtree<int> &to) {
+    auto first = from.lower_bound(migrated_lo);
+    auto last = from.upper_bound(migrated_hi);
+    for (auto it = first; it != last; ++it)
+        to.insert(*it);
+    from.erase(first, last);
+}
+
+BENCHMARK(ShardMigration, BenchInsertErase, 10, 1) {
+    migrate_by_insert(shard_a, shard_b);
+    migrate_by_insert(shard_b, shard_a);
+    sink = sink + shard_a.size();
+}
+
+BENCHMARK(ShardMigration, BenchSplice, 10, 1) {
+    shard_b.splice(shard_a, migrated_lo, migrated_hi);
+    shard_a.splice(shard_b, migrated_lo, migrated_hi);
+    sink = sink + shard_a.size();
+}
+
+// Merging 2^14 keys spread over the whole range of a 2^20 key tree. Every
+// variant copies the trees first; BenchCopyOnly measures just that.
+const auto sparse_keys = [] {
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < (1 << 14); i++)
+        tree.insert(2 * (i << 6) + 1);
+    return tree;
+}();
+
+BENCHMARK(InterleavedMerge, BenchCopyOnly, 10, 1) {
+    trees::AVLtree<int> target{large_tree};
+    trees::AVLtree<int> source{sparse_keys};
+    sink = sink + target.size() + source.size();
+}
+
+BENCHMARK(InterleavedMerge, BenchInsertLoop, 10, 1) {
+    trees::AVLtree<int> target{large_tree};
+    trees::AVLtree<int> source{sparse_keys};
+    for (auto key : source)
+        target.insert(key);
+    source.clear();
+    sink = sink + target.size();
+}
+
+BENCHMARK(InterleavedMerge, BenchMerge, 10, 1) {
+    trees::AVLtree<int> target{large_tree};
+    trees::AVLtree<int> source{sparse_keys};
+    target.merge(source);
+    sink = sink + target.size();
+}
+
+query::ThreadPool pool;
+
+BENCHMARK(NumKeysFromDiapason, BenchOurTreeParallel, 1, 1) {
+    trees::AVLtree<int> tree;
+
+    std::vector<size_t> answer_tree = query::get_answers_parallel<int>(
+        tree, queries.begin(), queries.end(), query::RangeCount{}, pool);
+}
+
+// A workload with long read-only runs: 64 inserts between runs of 20000
+// requests.
+const auto long_run_queries = [] {
+    std::vector<query::Query<int>> commands;
+    for (int run = 0; run < 16; run++) {
+        for (int i = 0; i < 64; i++)
+            commands.emplace_back(query::Key<int>{(run * 64 + i) * 7919 % 100003});
+        for (int i = 0; i < 20000; i++) {
+            int lo = (i * 7919) % 100003;
+            commands.emplace_back(query::Request<int>{lo, lo + i % 1000});
+        }
+    }
+    return commands;
+}();
+
+BENCHMARK(LongRuns, BenchSequential, 10, 1) {
+    trees::AVLtree<int> tree;
+    auto answers = query::get_answers<int>(tree, long_run_queries.begin(),
+                                           long_run_queries.end(),
+                                           query::RangeCount{});
+    sink = sink + answers.size();
+}
+
+BENCHMARK(LongRuns, BenchParallel, 10, 1) {
+    trees::AVLtree<int> tree;
+    auto answers = query::get_answers_parallel<int>(
+        tree, long_run_queries.begin(), long_run_queries.end(),
+        query::RangeCount{}, pool);
+    sink = sink + answers.size();
+}
+
+BENCHMARK(Parse, BenchIstream, 10, 1) {
+    std::ifstream in("benchs/data.dat");
+    std::vector<query::Query<int>> parsed;
+    query::process_input<int>(parsed, in);
+    sink = sink + parsed.size();
+}
+
+BENCHMARK(Parse, BenchFastParser, 10, 1) {
+    auto commands = query::parse_file<int>("benchs/data.dat");
+    sink = sink + commands.size();
+}
+
+class CountingResource final : public std::pmr::memory_resource {
+public:
+    size_t bytes_in_use() const noexcept { return bytes_in_use_; }
+
+private:
+    void *do_allocate(size_t bytes, size_t align) override {
+        bytes_in_use_ += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, align);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t align) override {
+        bytes_in_use_ -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override {
+        return this == &other;
+    }
+
+    size_t bytes_in_use_ = 0;
+};
+
+template <typename TreeT> void report_memory(const char *name) {
+    CountingResource resource;
+    TreeT tree{&resource};
+    for (auto key : sorted_keys)
+        tree.insert(key);
+
+    std::cout << name << ": " << resource.bytes_in_use() << " bytes for "
+              << tree.size() << " keys, "
+              << static_cast<double>(resource.bytes_in_use()) / tree.size()
+              << " bytes per key" << std::endl;
+}
+
+// Memory for the keys of the input, which repeat a lot.
+void report_multiset_memory() {
+    CountingResource ours_resource;
+    trees::AVLmultiset<int> ours{&ours_resource};
+    CountingResource std_resource;
+    std::pmr::multiset<int> std_multiset{&std_resource};
+    for (auto key : keys) {
+        ours.insert(key);
+        std_multiset.insert(key);
+    }
+
+    std::cout << "Multiset memory for " << keys.size() << " keys ("
+              << ours.distinct_size() << " distinct): AVLmultiset "
+              << ours_resource.bytes_in_use() << " bytes, std::multiset "
+              << std_resource.bytes_in_use() << " bytes" << std::endl;
+}
+
+// Extra memory of keeping a point-in-time view while 1000 updates go on.
+void report_snapshot_memory() {
+    const int updates = 1000;
+
+    CountingResource copy_resource;
+    trees::AVLtree<int> tree{&copy_resource};
+    for (auto key : sorted_keys)
+        tree.insert(key);
+    size_t live = copy_resource.bytes_in_use();
+    trees::AVLtree<int> copy{tree, &copy_resource};
+    for (int i = 0; i < updates; i++)
+        tree.insert(2 * i + 1);
+
+    CountingResource persistent_resource;
+    trees::PersistentAVLtree<int> persistent{&persistent_resource};
+    for (auto key : sorted_keys)
+        persistent.insert(key);
+    size_t persistent_live = persistent_resource.bytes_in_use();
+    auto snapshot = persistent.snapshot();
+    for (int i = 0; i < updates; i++)
+        persistent.insert(2 * i + 1);
+
+    std::cout << "Snapshot memory after " << updates << " updates: full copy "
+              << copy_resource.bytes_in_use() - live << " bytes, persistent "
+              << persistent_resource.bytes_in_use() - persistent_live
+              << " bytes" << std::endl;
+}
+
 int main() {
     std::ifstream in("benchs/data.dat");
     bool result = query::process_input<int>(queries, in);
@@ -41,6 +693,18 @@ int main() {
     }
     in.close();
 
+    for (auto &q : queries)
+        if (auto key = std::get_if<query::Key<int>>(&q))
+            keys.push_back(key->key_);
+
+    report_memory<trees::AVLtree<int>>("AVLtree memory");
+    report_memory<trees::CompactAVLtree<int>>("CompactAVLtree memory");
+    report_memory<trees::PackedTree<int>>("PackedTree memory");
+    std::cout << "PackedTree search: " << trees::simd::name(trees::simd::detected())
+              << " available" << std::endl;
+    report_snapshot_memory();
+    report_multiset_memory();
+
     hayai::MainRunner runner;
     return runner.Run();
 }
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <variant>
+#include <vector>
+
+#include "fast_input.hpp"
+#include "tree.hpp"
+#include "tree_file.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+template <typename FuncT> double measure(int runs, FuncT func) {
+    double best = 0;
+    for (int i = 0; i < runs; i++) {
+        auto start = Clock::now();
+        func();
+        double ms =
+            std::chrono::duration<double, std::milli>(Clock::now() - start)
+                .count();
+        if (i == 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+void report(const char *phase, double ms) {
+    std::cout << "  " << phase << ": " << ms << " ms" << std::endl;
+}
+
+trees::AVLtree<int> replay(const char *path) {
+    trees::AVLtree<int> tree;
+    for (auto &query : query::parse_file<int>(path))
+        if (auto key = std::get_if<query::Key<int>>(&query))
+            tree.insert(key->key_);
+    return tree;
+}
+
+// Compares a restart that replays commands with one that reads a snapshot.
+// The snapshot was just written, so its pages are in the page cache.
+template <typename ReplayT>
+void compare(const char *name, const std::filesystem::path &snapshot,
+             ReplayT replay_commands) {
+    const int runs = 5;
+    volatile size_t sink = 0;
+
+    auto tree = replay_commands();
+    trees::save(tree, snapshot);
+
+    std::cout << name << " (" << tree.size() << " keys, snapshot "
+              << std::filesystem::file_size(snapshot) << " bytes), best of "
+              << runs << " runs:" << std::endl;
+
+    report("replay commands", measure(runs, [&] {
+               sink = sink + replay_commands().size();
+           }));
+    report("load snapshot", measure(runs, [&] {
+               sink = sink + trees::load<int>(snapshot).size();
+           }));
+    report("map snapshot", measure(runs, [&] {
+               trees::MappedAVLtree<int> mapped{snapshot};
+               sink = sink + mapped.get_num_elems_from_diapason(0, 1000);
+           }));
+    report("map snapshot, no checksum", measure(runs, [&] {
+               trees::MappedAVLtree<int> mapped{snapshot, false};
+               sink = sink + mapped.get_num_elems_from_diapason(0, 1000);
+           }));
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "benchs/data.dat";
+    auto snapshot = std::filesystem::temp_directory_path() / "cold_start.snap";
+
+    compare(path, snapshot, [path] { return replay(path); });
+
+    std::vector<int> keys(1 << 20);
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist;
+    for (auto &key : keys)
+        key = dist(gen);
+
+    compare("random keys", snapshot, [&keys] {
+        trees::AVLtree<int> tree;
+        for (auto key : keys)
+            tree.insert(key);
+        return tree;
+    });
+
+    std::filesystem::remove(snapshot);
+    return 0;
+}
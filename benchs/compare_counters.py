@@ -0,0 +1,48 @@
+import json
+import sys
+
+# Compares two reports of the counters target and fails if a figure per
+# operation grew by more than the threshold:
+#   python3 benchs/compare_counters.py baseline.json current.json [0.10]
+
+metrics = ["ns_per_op", "cycles_per_op", "instructions_per_op",
+           "l1d_misses_per_op", "llc_misses_per_op", "branch_misses_per_op"]
+
+
+def load(path):
+    results = {}
+    for row in json.load(open(path))["results"]:
+        results[(row["benchmark"], row["container"], row["phase"])] = row
+    return results
+
+
+if len(sys.argv) < 3:
+    print("Usage: compare_counters.py BASELINE CURRENT [THRESHOLD]")
+    sys.exit(2)
+
+baseline = load(sys.argv[1])
+current = load(sys.argv[2])
+threshold = float(sys.argv[3]) if len(sys.argv) > 3 else 0.10
+
+regressions = 0
+for key in sorted(current):
+    if key not in baseline:
+        continue
+
+    for metric in metrics:
+        old = baseline[key].get(metric)
+        new = current[key].get(metric)
+        if old is None or new is None or old == 0:
+            continue
+
+        change = new / old - 1
+        mark = ""
+        if change > threshold:
+            mark = "  REGRESSION"
+            regressions += 1
+        print("/".join(key), metric, "%.4g -> %.4g (%+.1f%%)%s" % (old, new, 100 * change, mark))
+
+if regressions:
+    print(regressions, "regressions above", str(int(threshold * 100)) + "%")
+    sys.exit(1)
+print("No regressions above", str(int(threshold * 100)) + "%")
@@ -0,0 +1,110 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "concurrent_tree.hpp"
+#include "tree.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+const int initial_keys = 1 << 20;
+const int inserts_per_second = 100000;
+const auto run_time = std::chrono::milliseconds(500);
+
+// The only option before ConcurrentAVLtree: one mutex around everything.
+class LockedTree final {
+public:
+    void insert(int key) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        tree_.insert(key);
+    }
+
+    size_t get_num_elems_from_diapason(int key1, int key2) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return tree_.get_num_elems_from_diapason(key1, key2);
+    }
+
+private:
+    std::mutex mutex_;
+    trees::AVLtree<int> tree_;
+}; // class LockedTree
+
+// Runs num_readers range-counting threads next to one writer that inserts at
+// a fixed rate; returns range counts per second over all readers.
+template <typename TreeT> double measure(TreeT &tree, int num_readers) {
+    std::atomic<bool> done = false;
+    std::atomic<size_t> reads = 0;
+    std::atomic<size_t> sink = 0;
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < num_readers; i++) {
+        readers.emplace_back([&, i] {
+            std::mt19937 gen(i);
+            std::uniform_int_distribution<int> dist(0, 2 * initial_keys);
+            size_t count = 0;
+            size_t sum = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                int key = dist(gen);
+                sum += tree.get_num_elems_from_diapason(key, key + 1000);
+                count++;
+            }
+            reads += count;
+            sink += sum;
+        });
+    }
+
+    std::thread writer([&] {
+        std::mt19937 gen(12345);
+        std::uniform_int_distribution<int> dist(0, 2 * initial_keys);
+        auto start = Clock::now();
+        long inserted = 0;
+        while (!done.load(std::memory_order_relaxed)) {
+            auto elapsed = Clock::now() - start;
+            long due = std::chrono::duration_cast<std::chrono::microseconds>(
+                           elapsed).count() *
+                       inserts_per_second / 1000000;
+            for (; inserted < due; inserted++)
+                tree.insert(dist(gen));
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    std::this_thread::sleep_for(run_time);
+    done = true;
+    writer.join();
+    for (auto &reader : readers)
+        reader.join();
+
+    return reads * 1000.0 / run_time.count();
+}
+
+template <typename TreeT> void fill(TreeT &tree) {
+    for (int i = 0; i < initial_keys; i++)
+        tree.insert(2 * i);
+}
+} // namespace
+
+int main() {
+    unsigned max_threads = std::max(1U, std::thread::hardware_concurrency());
+
+    std::cout << "Range counts per second with " << inserts_per_second
+              << " inserts per second:" << std::endl;
+    std::cout << "readers\tlock-free\tmutex" << std::endl;
+
+    for (unsigned readers = 1; readers <= max_threads; readers *= 2) {
+        trees::ConcurrentAVLtree<int> concurrent;
+        LockedTree locked;
+        fill(concurrent);
+        fill(locked);
+
+        std::cout << readers << "\t" << measure(concurrent, readers) << "\t"
+                  << measure(locked, readers) << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "compact_tree.hpp"
+#include "fast_input.hpp"
+#include "packed_tree.hpp"
+#include "perf_report.hpp"
+#include "tree.hpp"
+
+namespace {
+volatile size_t sink = 0;
+
+struct Workload final {
+    std::string name;
+    std::vector<int> keys;
+    std::vector<std::pair<int, int>> ranges;
+};
+
+template <typename TreeT>
+size_t count_range(const TreeT &tree, int lo, int hi) {
+    if constexpr (requires { tree.get_num_elems_from_diapason(lo, hi); }) {
+        return tree.get_num_elems_from_diapason(lo, hi);
+    } else {
+        if (hi < lo)
+            return 0;
+        return static_cast<size_t>(
+            std::distance(tree.lower_bound(lo), tree.upper_bound(hi)));
+    }
+}
+
+// All keys go in first, then all ranges are counted, then the keys are
+// walked in order.
+template <typename TreeT>
+void run_phases(bench::Recorder &recorder, const Workload &work,
+                const char *container) {
+    TreeT tree;
+
+    recorder.measure(work.name, container, "insert", work.keys.size(), [&] {
+        for (auto key : work.keys)
+            tree.insert(key);
+    });
+
+    recorder.measure(work.name, container, "range_count", work.ranges.size(),
+                     [&] {
+                         size_t total = 0;
+                         for (auto [lo, hi] : work.ranges)
+                             total += count_range(tree, lo, hi);
+                         sink = sink + total;
+                     });
+
+    recorder.measure(work.name, container, "iterate", tree.size(), [&] {
+        long long total = 0;
+        for (auto key : tree)
+            total += key;
+        sink = sink + static_cast<size_t>(total);
+    });
+}
+
+void run_all(bench::Recorder &recorder, const Workload &work) {
+    run_phases<trees::AVLtree<int>>(recorder, work, "AVLtree");
+    run_phases<trees::CompactAVLtree<int>>(recorder, work, "CompactAVLtree");
+    run_phases<trees::PackedTree<int>>(recorder, work, "PackedTree");
+    run_phases<std::set<int>>(recorder, work, "std::set");
+}
+
+// The keys and requests of a command file; erases are left out.
+Workload read_workload(const char *path) {
+    Workload work;
+    work.name = std::filesystem::path{path}.stem().string();
+    for (auto &command : query::parse_file<int>(path)) {
+        if (auto key = std::get_if<query::Key<int>>(&command))
+            work.keys.push_back(key->key_);
+        else if (auto request = std::get_if<query::Request<int>>(&command))
+            work.ranges.emplace_back(request->key1_, request->key2_);
+    }
+    return work;
+}
+
+// Random keys over a range much wider than their number, so the trees do
+// not fit in the cache; each range holds about 64 keys.
+Workload random_workload() {
+    Workload work;
+    work.name = "random";
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(0, (1 << 30) - 1);
+
+    work.keys.resize(1 << 20);
+    for (auto &key : work.keys)
+        key = dist(gen);
+
+    work.ranges.resize(100000);
+    for (auto &[lo, hi] : work.ranges) {
+        lo = dist(gen);
+        hi = lo + (1 << 16);
+    }
+    return work;
+}
+
+// Reports are told apart by benchmark name, so a name already taken gets a
+// number appended.
+std::string unique_name(std::set<std::string> &used, const std::string &name) {
+    std::string unique = name;
+    for (int i = 2; !used.insert(unique).second; i++)
+        unique = name + "-" + std::to_string(i);
+    return unique;
+}
+
+void write_report(const bench::Recorder &recorder, bool csv,
+                  std::ostream &out, std::string_view benchmark = {}) {
+    if (csv)
+        recorder.write_csv(out, benchmark);
+    else
+        recorder.write_json(out, benchmark);
+}
+} // namespace
+
+// counters [--csv] [--out DIR] [command file...]
+// Prints one report for all benchmarks, or with --out writes a file per
+// benchmark into DIR.
+int main(int argc, char *argv[]) {
+    bool csv = false;
+    const char *out_dir = nullptr;
+    std::vector<const char *> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg{argv[i]};
+        if (arg == "--csv")
+            csv = true;
+        else if (arg == "--out" && i + 1 < argc)
+            out_dir = argv[++i];
+        else
+            paths.push_back(argv[i]);
+    }
+    if (paths.empty())
+        paths.push_back("benchs/data.dat");
+
+    bench::Recorder recorder;
+    if (!recorder.counters_available())
+        std::cerr << "Hardware counters are not available, timing only"
+                  << std::endl;
+
+    auto random = random_workload();
+    std::set<std::string> names{random.name};
+    for (auto path : paths) {
+        try {
+            auto work = read_workload(path);
+            work.name = unique_name(names, work.name);
+            run_all(recorder, work);
+        } catch (std::exception &ex) {
+            std::cerr << "Skipping " << path << ": " << ex.what() << std::endl;
+        }
+    }
+    run_all(recorder, random);
+
+    if (out_dir == nullptr) {
+        write_report(recorder, csv, std::cout);
+        return 0;
+    }
+
+    std::filesystem::create_directories(out_dir);
+    for (auto &benchmark : recorder.benchmarks()) {
+        auto file = std::filesystem::path{out_dir} /
+                    (benchmark + (csv ? ".csv" : ".json"));
+        std::ofstream out(file);
+        write_report(recorder, csv, out, benchmark);
+        if (!out) {
+            std::cerr << "Cannot write " << file << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "fast_input.hpp"
+#include "fast_output.hpp"
+#include "process_queries.hpp"
+#include "tree.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+template <typename FuncT> double measure(int runs, FuncT func) {
+    double best = 0;
+    for (int i = 0; i < runs; i++) {
+        auto start = Clock::now();
+        func();
+        double ms =
+            std::chrono::duration<double, std::milli>(Clock::now() - start)
+                .count();
+        if (i == 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+void report(const char *phase, double ms) {
+    std::cout << "  " << phase << ": " << ms << " ms" << std::endl;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+    const char *path = argc > 1 ? argv[1] : "benchs/data.dat";
+    const int runs = 5;
+
+    query::CommandBuffer<int> commands;
+    std::vector<query::Query<int>> queries;
+    std::vector<size_t> answers;
+    std::ofstream null_out("/dev/null");
+
+    std::cout << "Best of " << runs << " runs on " << path << ":" << std::endl;
+
+    report("parse (istream)", measure(runs, [&] {
+               queries.clear();
+               std::ifstream in(path);
+               query::process_input<int>(queries, in);
+           }));
+    report("parse (fast)", measure(runs, [&] {
+               commands = query::parse_file<int>(path);
+           }));
+
+    report("compute", measure(runs, [&] {
+               trees::AVLtree<int> tree;
+               answers = query::get_answers<int>(tree, commands.begin(),
+                                                 commands.end(),
+                                                 query::RangeCount{});
+           }));
+
+    report("output (ostream <<)", measure(runs, [&] {
+               for (size_t answer : answers)
+                   null_out << answer << " ";
+               null_out << std::endl;
+           }));
+    report("output (writer, text)", measure(runs, [&] {
+               query::AnswerWriter writer{null_out};
+               query::print_answers(answers, writer);
+           }));
+    report("output (writer, binary)", measure(runs, [&] {
+               query::AnswerWriter writer{null_out,
+                                          query::OutputFormat::binary};
+               query::print_answers(answers, writer);
+           }));
+
+    std::cout << answers.size() << " answers" << std::endl;
+    return 0;
+}
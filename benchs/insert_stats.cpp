@@ -0,0 +1,46 @@
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "tree.hpp"
+
+namespace {
+using StatsTree = trees::AVLtree<int, std::less<int>, trees::details::ArenaStorage,
+                                 trees::aggregates::Count, trees::stats::Insert>;
+
+void report(const char *name, const std::vector<int> &keys) {
+    StatsTree tree;
+    for (auto key : keys)
+        tree.insert(key);
+
+    const auto &stats = tree.stats();
+    double inserts = static_cast<double>(stats.inserts);
+
+    std::cout << name << ": " << stats.inserts << " inserts, "
+              << stats.rotations / inserts << " rotations, "
+              << stats.height_updates / inserts << " height updates, "
+              << stats.touched_nodes / inserts
+              << " touched nodes per insert (tree height "
+              << tree.height() << ")" << std::endl;
+}
+} // namespace
+
+int main() {
+    const int num_keys = 1 << 20;
+
+    std::vector<int> ascending(num_keys);
+    for (int i = 0; i < num_keys; i++)
+        ascending[i] = i;
+
+    std::vector<int> random(num_keys);
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist;
+    for (auto &key : random)
+        key = dist(gen);
+
+    report("Ascending keys", ascending);
+    report("Random keys", random);
+
+    return 0;
+}
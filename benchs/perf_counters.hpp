@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#define BENCH_HAS_PERF_EVENTS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+enum class Event { cycles, instructions, l1d_misses, llc_misses, branch_misses };
+
+inline constexpr std::array<Event, 5> all_events = {
+    Event::cycles, Event::instructions, Event::l1d_misses, Event::llc_misses,
+    Event::branch_misses};
+
+inline const char *name(Event event) noexcept {
+    switch (event) {
+    case Event::cycles:
+        return "cycles";
+    case Event::instructions:
+        return "instructions";
+    case Event::l1d_misses:
+        return "l1d_misses";
+    case Event::llc_misses:
+        return "llc_misses";
+    default:
+        return "branch_misses";
+    }
+}
+
+// Hardware counters of the calling thread in user space. A counter the
+// system refuses (no PMU in a virtual machine, perf_event_paranoid, not
+// Linux) stays closed and reads as empty, so the caller still gets its
+// timings.
+class PerfCounters final {
+public:
+    PerfCounters() {
+        fds_.fill(-1);
+#ifdef BENCH_HAS_PERF_EVENTS
+        for (size_t i = 0; i < all_events.size(); i++)
+            fds_[i] = open(all_events[i]);
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    ~PerfCounters() {
+#ifdef BENCH_HAS_PERF_EVENTS
+        for (int fd : fds_)
+            if (fd != -1)
+                close(fd);
+#endif
+    }
+
+    bool available() const noexcept {
+        for (int fd : fds_)
+            if (fd != -1)
+                return true;
+        return false;
+    }
+
+    bool available(Event event) const noexcept {
+        return fds_[static_cast<size_t>(event)] != -1;
+    }
+
+    void start() noexcept {
+#ifdef BENCH_HAS_PERF_EVENTS
+        for (int fd : fds_) {
+            if (fd != -1) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void stop() noexcept {
+#ifdef BENCH_HAS_PERF_EVENTS
+        for (int fd : fds_)
+            if (fd != -1)
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+    }
+
+    // The count between the last start and stop. When the kernel had to
+    // share the hardware between more events than it has counters, the
+    // count is scaled up to the whole interval; an event that never got a
+    // counter is unknown, not zero.
+    std::optional<std::uint64_t> read(Event event) const noexcept {
+#ifdef BENCH_HAS_PERF_EVENTS
+        int fd = fds_[static_cast<size_t>(event)];
+        std::uint64_t values[3] = {};
+        if (fd == -1 || ::read(fd, values, sizeof(values)) != sizeof(values))
+            return std::nullopt;
+
+        auto [count, enabled, running] = values;
+        if (running == 0)
+            return std::nullopt;
+        if (running < enabled)
+            count = static_cast<std::uint64_t>(static_cast<double>(count) *
+                                               enabled / running);
+        return count;
+#else
+        (void)event;
+        return std::nullopt;
+#endif
+    }
+
+private:
+#ifdef BENCH_HAS_PERF_EVENTS
+    static int open(Event event) noexcept {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format =
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        switch (event) {
+        case Event::cycles:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case Event::instructions:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case Event::l1d_misses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case Event::llc_misses:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case Event::branch_misses:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        }
+
+        long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        return fd < 0 ? -1 : static_cast<int>(fd);
+    }
+#endif
+
+    std::array<int, all_events.size()> fds_;
+}; // class PerfCounters
+
+} // namespace bench
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "perf_counters.hpp"
+
+namespace bench {
+
+// One measured phase of one container; the time and the counts cover all
+// of its operations.
+struct Sample final {
+    std::string benchmark;
+    std::string container;
+    std::string phase;
+    size_t operations = 0;
+    double ns = 0;
+    std::array<std::optional<std::uint64_t>, all_events.size()> counts;
+};
+
+// Runs phases under the hardware counters and writes the figures per
+// operation as JSON or CSV. Each row also gives its time relative to the
+// baseline container in the same benchmark and phase.
+class Recorder final {
+    using Clock = std::chrono::steady_clock;
+
+public:
+    explicit Recorder(std::string baseline = "std::set")
+        : baseline_(std::move(baseline)) {}
+
+    template <typename FuncT>
+    void measure(std::string benchmark, std::string container,
+                 std::string phase, size_t operations, FuncT func) {
+        Sample sample;
+        sample.benchmark = std::move(benchmark);
+        sample.container = std::move(container);
+        sample.phase = std::move(phase);
+        sample.operations = operations;
+
+        auto start = Clock::now();
+        counters_.start();
+        func();
+        counters_.stop();
+        sample.ns = std::chrono::duration<double, std::nano>(Clock::now() -
+                                                             start)
+                        .count();
+
+        for (size_t i = 0; i < all_events.size(); i++)
+            sample.counts[i] = counters_.read(all_events[i]);
+        samples_.push_back(std::move(sample));
+    }
+
+    bool counters_available() const noexcept { return counters_.available(); }
+
+    const std::vector<Sample> &samples() const noexcept { return samples_; }
+
+    std::vector<std::string> benchmarks() const {
+        std::vector<std::string> names;
+        for (auto &sample : samples_)
+            if (std::find(names.begin(), names.end(), sample.benchmark) ==
+                names.end())
+                names.push_back(sample.benchmark);
+        return names;
+    }
+
+    // Writes the samples of one benchmark, or of all when it is empty.
+    void write_json(std::ostream &out, std::string_view benchmark = {}) const {
+        out << "{\n  \"baseline\": ";
+        write_string(out, baseline_);
+        out << ",\n  \"results\": [";
+
+        bool first = true;
+        for (auto &sample : samples_) {
+            if (!benchmark.empty() && sample.benchmark != benchmark)
+                continue;
+
+            out << (first ? "\n" : ",\n") << "    {\"benchmark\": ";
+            first = false;
+            write_string(out, sample.benchmark);
+            out << ", \"container\": ";
+            write_string(out, sample.container);
+            out << ", \"phase\": ";
+            write_string(out, sample.phase);
+            out << ", \"operations\": " << sample.operations;
+
+            out << ", \"ns_per_op\": ";
+            write_number(out, per_operation(sample, sample.ns));
+            for (size_t i = 0; i < all_events.size(); i++) {
+                out << ", \"" << name(all_events[i]) << "_per_op\": ";
+                write_number(out, per_operation(sample, sample.counts[i]));
+            }
+            out << ", \"ns_vs_baseline\": ";
+            write_number(out, relative_time(sample));
+            out << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    void write_csv(std::ostream &out, std::string_view benchmark = {}) const {
+        out << "benchmark,container,phase,operations,ns_per_op";
+        for (auto event : all_events)
+            out << "," << name(event) << "_per_op";
+        out << ",ns_vs_baseline\n";
+
+        for (auto &sample : samples_) {
+            if (!benchmark.empty() && sample.benchmark != benchmark)
+                continue;
+
+            out << sample.benchmark << "," << sample.container << ","
+                << sample.phase << "," << sample.operations << ",";
+            write_value(out, per_operation(sample, sample.ns));
+            for (auto &count : sample.counts) {
+                out << ",";
+                write_value(out, per_operation(sample, count));
+            }
+            out << ",";
+            write_value(out, relative_time(sample));
+            out << "\n";
+        }
+    }
+
+private:
+    static std::optional<double> per_operation(const Sample &sample,
+                                               double value) {
+        if (sample.operations == 0)
+            return std::nullopt;
+        return value / static_cast<double>(sample.operations);
+    }
+
+    static std::optional<double>
+    per_operation(const Sample &sample, std::optional<std::uint64_t> value) {
+        if (!value)
+            return std::nullopt;
+        return per_operation(sample, static_cast<double>(*value));
+    }
+
+    std::optional<double> relative_time(const Sample &sample) const {
+        for (auto &other : samples_) {
+            if (other.container == baseline_ &&
+                other.benchmark == sample.benchmark &&
+                other.phase == sample.phase) {
+                auto own = per_operation(sample, sample.ns);
+                auto base = per_operation(other, other.ns);
+                if (own && base && *base > 0)
+                    return *own / *base;
+            }
+        }
+        return std::nullopt;
+    }
+
+    static void write_string(std::ostream &out, std::string_view text) {
+        out << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                out << '\\';
+            out << c;
+        }
+        out << '"';
+    }
+
+    static void write_number(std::ostream &out, std::optional<double> value) {
+        if (value)
+            out << *value;
+        else
+            out << "null";
+    }
+
+    // CSV leaves a missing value empty.
+    static void write_value(std::ostream &out, std::optional<double> value) {
+        if (value)
+            out << *value;
+    }
+
+    PerfCounters counters_;
+    std::string baseline_;
+    std::vector<Sample> samples_;
+}; // class Recorder
+
+} // namespace bench
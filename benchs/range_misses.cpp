@@ -0,0 +1,98 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "frozen_index.hpp"
+#include "packed_tree.hpp"
+#include "perf_counters.hpp"
+#include "tree.hpp"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// One pass to warm up, then one measured pass; the figures are per query.
+template <typename FuncT>
+void report(bench::PerfCounters &counters, const char *name, size_t queries,
+            FuncT func) {
+    volatile size_t sink = func();
+
+    auto start = Clock::now();
+    counters.start();
+    sink = sink + func();
+    counters.stop();
+    double ns =
+        std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+    std::cout << "  " << name << ": " << ns / queries << " ns";
+    for (auto event : {bench::Event::l1d_misses, bench::Event::llc_misses,
+                       bench::Event::instructions}) {
+        if (auto value = counters.read(event))
+            std::cout << ", " << static_cast<double>(*value) / queries << " "
+                      << bench::name(event);
+    }
+    std::cout << std::endl;
+}
+
+template <typename TreeT>
+size_t count_ranges(const TreeT &tree,
+                    const std::vector<std::pair<int, int>> &ranges) {
+    size_t total = 0;
+    for (auto [lo, hi] : ranges)
+        total += tree.get_num_elems_from_diapason(lo, hi);
+    return total;
+}
+} // namespace
+
+// Range counts over random keys, more than fit in the cache. The two
+// descents are what get_num_elems_from_diapason did before it shared the
+// path down to the node where the bounds part.
+int main() {
+    const int size = 1 << 21;
+    const int queries = 1000000;
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(0, (1 << 30) - 1);
+
+    trees::AVLtree<int> tree;
+    trees::PackedTree<int> packed;
+    for (int i = 0; i < size; i++) {
+        int key = dist(gen);
+        tree.insert(key);
+        packed.insert(key);
+    }
+    auto frozen = trees::freeze(tree);
+
+    bench::PerfCounters counters;
+    if (!counters.available())
+        std::cout << "Hardware counters are not available, timing only"
+                  << std::endl;
+
+    for (int width : {1 << 14, 1 << 24}) {
+        std::vector<std::pair<int, int>> ranges;
+        for (int i = 0; i < queries; i++) {
+            int lo = dist(gen);
+            ranges.emplace_back(lo, lo + width);
+        }
+
+        std::cout << tree.size() << " keys, ranges of about "
+                  << static_cast<long long>(tree.size()) * width / (1 << 30)
+                  << " keys:" << std::endl;
+
+        report(counters, "AVLtree, two descents", queries, [&] {
+            size_t total = 0;
+            for (auto [lo, hi] : ranges)
+                total += tree.rank(hi + 1) - tree.rank(lo);
+            return total;
+        });
+        report(counters, "AVLtree, one pass", queries,
+               [&] { return count_ranges(tree, ranges); });
+        report(counters, "PackedTree", queries,
+               [&] { return count_ranges(packed, ranges); });
+        report(counters, "FrozenIndex", queries,
+               [&] { return count_ranges(frozen, ranges); });
+    }
+
+    return 0;
+}
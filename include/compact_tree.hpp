@@ -0,0 +1,451 @@
+#pragma once
+
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory_resource>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "packed_tree.hpp"
+#include "tree.hpp"
+
+namespace trees {
+
+// AVL tree whose nodes live in one pool and refer to each other by 32-bit
+// indices. A node keeps a single subtree size and an 8-bit height and has no
+// parent link: insert and erase remember the descent path instead, and
+// iterators carry their own root-to-node path. Any insert or erase
+// invalidates all iterators.
+template <typename KeyT = int, typename Compare = std::less<KeyT>>
+class CompactAVLtree final {
+    using index_t = std::uint32_t;
+
+    static constexpr index_t nil = std::numeric_limits<index_t>::max();
+    static constexpr size_t max_height = 64;
+
+    struct Node final {
+        Node(const KeyT &key) : key_(key) {}
+
+        KeyT key_;
+        index_t left_ = nil;
+        index_t right_ = nil;
+        index_t size_ = 1;
+        std::int8_t height_ = 1;
+    }; // struct Node
+
+    using Path = std::array<index_t, max_height>;
+
+    class Iterator final {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = KeyT;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        Iterator() = default;
+
+        Iterator &operator++() noexcept {
+            index_t cur = path_[depth_ - 1];
+
+            if (tree_->nodes_[cur].right_ != nil) {
+                path_[depth_++] = tree_->nodes_[cur].right_;
+                descend_left();
+                return *this;
+            }
+
+            index_t child = nil;
+            do {
+                child = path_[--depth_];
+            } while (depth_ > 0 && tree_->nodes_[path_[depth_ - 1]].right_ == child);
+
+            return *this;
+        }
+
+        Iterator operator++(int) noexcept {
+            Iterator it(*this);
+            ++(*this);
+            return it;
+        }
+
+        const KeyT &operator*() const {
+            if (depth_ == 0)
+                throw std::out_of_range("Iterator is at post-end");
+
+            return tree_->nodes_[path_[depth_ - 1]].key_;
+        }
+
+        const KeyT *operator->() const { return &**this; }
+
+        friend bool operator==(const Iterator &lhs,
+                               const Iterator &rhs) noexcept {
+            if (lhs.tree_ != rhs.tree_ || lhs.depth_ != rhs.depth_)
+                return false;
+
+            return lhs.depth_ == 0 ||
+                   lhs.path_[lhs.depth_ - 1] == rhs.path_[rhs.depth_ - 1];
+        }
+
+    private:
+        explicit Iterator(const CompactAVLtree &tree) : tree_(&tree) {}
+
+        void descend_left() noexcept {
+            index_t cur = path_[depth_ - 1];
+            while (tree_->nodes_[cur].left_ != nil) {
+                cur = tree_->nodes_[cur].left_;
+                path_[depth_++] = cur;
+            }
+        }
+
+        const CompactAVLtree *tree_ = nullptr;
+        Path path_;
+        size_t depth_ = 0;
+
+        friend class CompactAVLtree;
+    }; // class Iterator
+
+public:
+    using key_type = KeyT;
+    using value_type = KeyT;
+    using size_type = size_t;
+    using key_compare = Compare;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+
+    static constexpr size_t node_size = sizeof(Node);
+
+    CompactAVLtree() = default;
+
+    explicit CompactAVLtree(std::pmr::memory_resource *resource,
+                            const Compare &comp = Compare{})
+        : comp_(comp), nodes_(resource) {}
+
+    explicit CompactAVLtree(const Compare &comp) : comp_(comp) {}
+
+    size_t size() const noexcept { return size_of(root_); }
+
+    bool empty() const noexcept { return root_ == nil; }
+
+    int height() const noexcept { return height_of(root_); }
+
+    // Bytes reserved by the node pool, including freed slots.
+    size_t memory_usage() const noexcept {
+        return nodes_.capacity() * sizeof(Node);
+    }
+
+    bool insert(const KeyT &key) {
+        Path path;
+        size_t depth = 0;
+        index_t cur = root_;
+
+        while (cur != nil) {
+            path[depth++] = cur;
+            if (comp_(key, nodes_[cur].key_))
+                cur = nodes_[cur].left_;
+            else if (comp_(nodes_[cur].key_, key))
+                cur = nodes_[cur].right_;
+            else
+                return false;
+        }
+
+        index_t node = make_node(key);
+
+        if (depth == 0) {
+            root_ = node;
+            return true;
+        }
+
+        index_t parent = path[depth - 1];
+        if (comp_(key, nodes_[parent].key_))
+            nodes_[parent].left_ = node;
+        else
+            nodes_[parent].right_ = node;
+
+        fix_path(path, depth);
+        return true;
+    }
+
+    size_t erase(const KeyT &key) {
+        Path path;
+        size_t depth = 0;
+        index_t cur = root_;
+
+        while (cur != nil) {
+            path[depth++] = cur;
+            if (comp_(key, nodes_[cur].key_))
+                cur = nodes_[cur].left_;
+            else if (comp_(nodes_[cur].key_, key))
+                cur = nodes_[cur].right_;
+            else
+                break;
+        }
+
+        if (cur == nil)
+            return 0;
+
+        if (nodes_[cur].left_ != nil && nodes_[cur].right_ != nil) {
+            index_t next = nodes_[cur].right_;
+            path[depth++] = next;
+            while (nodes_[next].left_ != nil) {
+                next = nodes_[next].left_;
+                path[depth++] = next;
+            }
+
+            std::swap(nodes_[cur].key_, nodes_[next].key_);
+            cur = next;
+        }
+
+        index_t child =
+            nodes_[cur].left_ != nil ? nodes_[cur].left_ : nodes_[cur].right_;
+        depth--;
+        replace_child(path, depth, cur, child);
+        free_node(cur);
+
+        fix_path(path, depth);
+        return 1;
+    }
+
+    bool contains(const KeyT &key) const noexcept {
+        index_t cur = root_;
+
+        while (cur != nil) {
+            if (comp_(key, nodes_[cur].key_))
+                cur = nodes_[cur].left_;
+            else if (comp_(nodes_[cur].key_, key))
+                cur = nodes_[cur].right_;
+            else
+                return true;
+        }
+        return false;
+    }
+
+    Iterator lower_bound(const KeyT &key) const noexcept {
+        Iterator it{*this};
+        size_t found_depth = 0;
+        index_t cur = root_;
+
+        while (cur != nil) {
+            it.path_[it.depth_++] = cur;
+            if (comp_(nodes_[cur].key_, key)) {
+                cur = nodes_[cur].right_;
+            } else {
+                found_depth = it.depth_;
+                cur = nodes_[cur].left_;
+            }
+        }
+
+        it.depth_ = found_depth;
+        return it;
+    }
+
+    // Number of keys that are less than key.
+    size_t rank(const KeyT &key) const noexcept {
+        index_t cur = root_;
+        size_t count = 0;
+
+        while (cur != nil) {
+            if (comp_(nodes_[cur].key_, key)) {
+                count += size_of(nodes_[cur].left_) + 1;
+                cur = nodes_[cur].right_;
+            } else {
+                cur = nodes_[cur].left_;
+            }
+        }
+        return count;
+    }
+
+    // The k-th smallest key, counting from zero.
+    const KeyT &select(size_t k) const {
+        index_t cur = root_;
+
+        while (cur != nil) {
+            size_t left = size_of(nodes_[cur].left_);
+            if (k < left) {
+                cur = nodes_[cur].left_;
+            } else if (k == left) {
+                return nodes_[cur].key_;
+            } else {
+                k -= left + 1;
+                cur = nodes_[cur].right_;
+            }
+        }
+
+        throw std::out_of_range("Index is out of tree size");
+    }
+
+    size_t get_num_elems_from_diapason(const KeyT &key1,
+                                       const KeyT &key2) const noexcept {
+        if (comp_(key2, key1))
+            return 0;
+
+        return count_not_greater(key2) - rank(key1);
+    }
+
+    Iterator begin() const noexcept {
+        Iterator it{*this};
+        if (root_ != nil) {
+            it.path_[it.depth_++] = root_;
+            it.descend_left();
+        }
+        return it;
+    }
+
+    Iterator end() const noexcept { return Iterator{*this}; }
+
+private:
+    int height_of(index_t node) const noexcept {
+        return node == nil ? 0 : nodes_[node].height_;
+    }
+
+    size_t size_of(index_t node) const noexcept {
+        return node == nil ? 0 : nodes_[node].size_;
+    }
+
+    size_t count_not_greater(const KeyT &key) const noexcept {
+        index_t cur = root_;
+        size_t count = 0;
+
+        while (cur != nil) {
+            if (comp_(key, nodes_[cur].key_)) {
+                cur = nodes_[cur].left_;
+            } else {
+                count += size_of(nodes_[cur].left_) + 1;
+                cur = nodes_[cur].right_;
+            }
+        }
+        return count;
+    }
+
+    index_t make_node(const KeyT &key) {
+        if (free_ != nil) {
+            index_t node = free_;
+            free_ = nodes_[node].left_;
+            nodes_[node] = Node{key};
+            return node;
+        }
+
+        if (nodes_.size() >= nil)
+            throw std::length_error("Compact tree is out of node indices");
+
+        nodes_.emplace_back(key);
+        return static_cast<index_t>(nodes_.size() - 1);
+    }
+
+    void free_node(index_t node) noexcept {
+        nodes_[node].left_ = free_;
+        free_ = node;
+    }
+
+    void update(index_t node) noexcept {
+        Node &n = nodes_[node];
+        n.height_ = static_cast<std::int8_t>(
+            1 + std::max(height_of(n.left_), height_of(n.right_)));
+        n.size_ = static_cast<index_t>(1 + size_of(n.left_) +
+                                       size_of(n.right_));
+    }
+
+    index_t rotate_right(index_t x) noexcept {
+        index_t y = nodes_[x].left_;
+        nodes_[x].left_ = nodes_[y].right_;
+        nodes_[y].right_ = x;
+        update(x);
+        update(y);
+        return y;
+    }
+
+    index_t rotate_left(index_t x) noexcept {
+        index_t y = nodes_[x].right_;
+        nodes_[x].right_ = nodes_[y].left_;
+        nodes_[y].left_ = x;
+        update(x);
+        update(y);
+        return y;
+    }
+
+    int balance_factor(index_t node) const noexcept {
+        return height_of(nodes_[node].left_) - height_of(nodes_[node].right_);
+    }
+
+    index_t rebalance(index_t node) noexcept {
+        update(node);
+        int balance = balance_factor(node);
+
+        if (balance > 1) {
+            if (balance_factor(nodes_[node].left_) < 0)
+                nodes_[node].left_ = rotate_left(nodes_[node].left_);
+            return rotate_right(node);
+        }
+
+        if (balance < -1) {
+            if (balance_factor(nodes_[node].right_) > 0)
+                nodes_[node].right_ = rotate_right(nodes_[node].right_);
+            return rotate_left(node);
+        }
+
+        return node;
+    }
+
+    // Puts child in place of path[depth], the child of path[depth - 1].
+    void replace_child(const Path &path, size_t depth, index_t old_child,
+                       index_t child) noexcept {
+        if (depth == 0) {
+            root_ = child;
+            return;
+        }
+
+        Node &parent = nodes_[path[depth - 1]];
+        if (parent.left_ == old_child)
+            parent.left_ = child;
+        else
+            parent.right_ = child;
+    }
+
+    void fix_path(const Path &path, size_t depth) noexcept {
+        while (depth-- > 0) {
+            index_t node = path[depth];
+            replace_child(path, depth, node, rebalance(node));
+        }
+    }
+
+    [[no_unique_address]] Compare comp_;
+    std::pmr::vector<Node> nodes_;
+    index_t root_ = nil;
+    index_t free_ = nil;
+}; // class CompactAVLtree
+
+namespace layout {
+struct pointer final {};
+struct compact final {};
+struct packed final {};
+} // namespace layout
+
+namespace details {
+template <typename KeyT, typename Compare, typename Layout>
+struct LayoutTree final {
+    using type = AVLtree<KeyT, Compare>;
+};
+
+template <typename KeyT, typename Compare>
+struct LayoutTree<KeyT, Compare, layout::compact> final {
+    using type = CompactAVLtree<KeyT, Compare>;
+};
+
+// The packed layout needs integral keys in their natural order; other keys
+// keep the pointer layout.
+template <std::integral KeyT>
+struct LayoutTree<KeyT, std::less<KeyT>, layout::packed> final {
+    using type = PackedTree<KeyT>;
+};
+} // namespace details
+
+template <typename KeyT = int, typename Compare = std::less<KeyT>,
+          typename Layout = layout::pointer>
+using basic_tree = typename details::LayoutTree<KeyT, Compare, Layout>::type;
+
+} // namespace trees
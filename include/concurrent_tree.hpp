@@ -0,0 +1,412 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory_resource>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+namespace trees {
+
+// AVL tree for many concurrent readers and writers that are rare compared to
+// them. Published nodes are never changed: a writer copies the path it
+// touches, swaps in the new root and retires the replaced nodes. Readers take
+// no locks; they announce the epoch they started in, and retired nodes are
+// freed only once every reader that could still see them is gone. Writers
+// are serialized by a mutex.
+template <typename KeyT = int, typename Compare = std::less<KeyT>,
+          template <typename> class Storage = details::ArenaStorage>
+class ConcurrentAVLtree final {
+    struct Node final {
+        Node(const KeyT &key, const Node *left, const Node *right)
+            : key_(key), left_(left), right_(right),
+              height_(1 + std::max(height_of(left), height_of(right))),
+              size_(1 + size_of(left) + size_of(right)) {}
+
+        KeyT key_;
+        const Node *left_;
+        const Node *right_;
+        int height_;
+        size_t size_;
+    }; // struct Node
+
+    struct alignas(64) ReaderSlot final {
+        std::atomic<std::uint64_t> epoch_{0};
+    };
+
+    struct Retired final {
+        std::uint64_t epoch_;
+        const Node *node_;
+    };
+
+    class Pin final {
+    public:
+        explicit Pin(const ConcurrentAVLtree &tree) noexcept
+            : slot_(tree.pin()),
+              root_(tree.root_.load(std::memory_order_seq_cst)) {}
+
+        Pin(const Pin &) = delete;
+        Pin &operator=(const Pin &) = delete;
+
+        ~Pin() { slot_->epoch_.store(0, std::memory_order_release); }
+
+        const Node *root() const noexcept { return root_; }
+
+    private:
+        ReaderSlot *slot_;
+        const Node *root_;
+    }; // class Pin
+
+public:
+    using key_type = KeyT;
+    using value_type = KeyT;
+    using size_type = size_t;
+    using key_compare = Compare;
+
+    // Readers running at the same time beyond this count wait for a slot.
+    static constexpr size_t max_readers = 64;
+
+    explicit ConcurrentAVLtree(std::pmr::memory_resource *resource =
+                                   std::pmr::get_default_resource())
+        : ConcurrentAVLtree(Compare{}, resource) {}
+
+    explicit ConcurrentAVLtree(const Compare &comp,
+                               std::pmr::memory_resource *resource =
+                                   std::pmr::get_default_resource())
+        : comp_(comp), storage_(resource) {
+        created_.reserve(max_path_nodes);
+        pending_.reserve(max_path_nodes);
+    }
+
+    ConcurrentAVLtree(const ConcurrentAVLtree &) = delete;
+    ConcurrentAVLtree &operator=(const ConcurrentAVLtree &) = delete;
+
+    // Must not run while other threads still use the tree.
+    ~ConcurrentAVLtree() {
+        if constexpr (Storage<Node>::frees_in_bulk &&
+                      std::is_trivially_destructible_v<KeyT>)
+            return;
+
+        destroy(root_.load(std::memory_order_relaxed));
+        for (auto &retired : retired_)
+            free_node(retired.node_);
+    }
+
+    size_t size() const noexcept {
+        Pin pin{*this};
+        return size_of(pin.root());
+    }
+
+    bool empty() const noexcept { return size() == 0; }
+
+    int height() const noexcept {
+        Pin pin{*this};
+        return height_of(pin.root());
+    }
+
+    Compare key_comp() const { return comp_; }
+
+    bool contains(const KeyT &key) const {
+        Pin pin{*this};
+        const Node *cur = pin.root();
+
+        while (cur != nullptr) {
+            if (comp_(key, cur->key_))
+                cur = cur->left_;
+            else if (comp_(cur->key_, key))
+                cur = cur->right_;
+            else
+                return true;
+        }
+        return false;
+    }
+
+    // Number of keys that are less than key.
+    size_t rank(const KeyT &key) const {
+        Pin pin{*this};
+        return count_less(pin.root(), key);
+    }
+
+    // Both bounds are counted on the same version of the tree.
+    size_t get_num_elems_from_diapason(const KeyT &key1,
+                                       const KeyT &key2) const {
+        if (comp_(key2, key1))
+            return 0;
+
+        Pin pin{*this};
+        return count_not_greater(pin.root(), key2) -
+               count_less(pin.root(), key1);
+    }
+
+    bool insert(const KeyT &key) {
+        std::lock_guard<std::mutex> lock{write_mutex_};
+        bool inserted = false;
+
+        write([&](const Node *root) {
+            return insert_copy(root, key, inserted);
+        });
+        return inserted;
+    }
+
+    size_t erase(const KeyT &key) {
+        std::lock_guard<std::mutex> lock{write_mutex_};
+        bool erased = false;
+
+        write([&](const Node *root) { return erase_copy(root, key, erased); });
+        return erased ? 1 : 0;
+    }
+
+private:
+    // A path copy creates and replaces at most a few nodes per level, and an
+    // AVL tree of any size that fits in memory is less than 100 levels high.
+    static constexpr size_t max_path_nodes = 512;
+    static constexpr size_t reclaim_threshold = 1024;
+
+    static int height_of(const Node *node) noexcept {
+        return node ? node->height_ : 0;
+    }
+
+    static size_t size_of(const Node *node) noexcept {
+        return node ? node->size_ : 0;
+    }
+
+    ReaderSlot *pin() const noexcept {
+        static thread_local const size_t hint =
+            std::hash<std::thread::id>{}(std::this_thread::get_id());
+
+        for (size_t i = hint;; i++) {
+            ReaderSlot &slot = slots_[i % max_readers];
+            std::uint64_t idle = 0;
+            std::uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+            if (slot.epoch_.compare_exchange_strong(idle, epoch,
+                                                    std::memory_order_seq_cst))
+                return &slot;
+
+            // Every slot is taken: let a reader finish before the next round.
+            if ((i + 1 - hint) % max_readers == 0)
+                std::this_thread::yield();
+        }
+    }
+
+    size_t count_less(const Node *cur, const KeyT &key) const {
+        size_t count = 0;
+
+        while (cur != nullptr) {
+            if (comp_(cur->key_, key)) {
+                count += size_of(cur->left_) + 1;
+                cur = cur->right_;
+            } else {
+                cur = cur->left_;
+            }
+        }
+        return count;
+    }
+
+    size_t count_not_greater(const Node *cur, const KeyT &key) const {
+        size_t count = 0;
+
+        while (cur != nullptr) {
+            if (comp_(key, cur->key_)) {
+                cur = cur->left_;
+            } else {
+                count += size_of(cur->left_) + 1;
+                cur = cur->right_;
+            }
+        }
+        return count;
+    }
+
+    // Runs one path copy and publishes its root. If the copy throws, the
+    // nodes it made are freed and the published tree stays as it was.
+    template <typename CopyT> void write(CopyT copy) {
+        const Node *root = root_.load(std::memory_order_relaxed);
+        const Node *new_root = nullptr;
+
+        try {
+            new_root = copy(root);
+            retired_.reserve(retired_.size() + pending_.size());
+        } catch (...) {
+            for (auto node : created_)
+                free_node(node);
+            created_.clear();
+            pending_.clear();
+            throw;
+        }
+
+        created_.clear();
+        if (new_root == root)
+            return;
+
+        root_.store(new_root, std::memory_order_seq_cst);
+        std::uint64_t epoch = epoch_.fetch_add(1, std::memory_order_seq_cst);
+        for (auto node : pending_)
+            retired_.push_back({epoch, node});
+        pending_.clear();
+
+        if (retired_.size() >= reclaim_threshold)
+            reclaim();
+    }
+
+    // A node retired in epoch e may be in use only by readers that started
+    // in epoch e or earlier.
+    void reclaim() noexcept {
+        std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+        for (auto &slot : slots_) {
+            std::uint64_t epoch = slot.epoch_.load(std::memory_order_seq_cst);
+            if (epoch != 0)
+                oldest = std::min(oldest, epoch);
+        }
+
+        auto it = retired_.begin();
+        for (; it != retired_.end() && it->epoch_ < oldest; ++it)
+            free_node(it->node_);
+        retired_.erase(retired_.begin(), it);
+    }
+
+    const Node *make_node(const KeyT &key, const Node *left,
+                          const Node *right) {
+        const Node *node = storage_.get_obj(key, left, right);
+        created_.push_back(node);
+        return node;
+    }
+
+    void retire(const Node *node) { pending_.push_back(node); }
+
+    void free_node(const Node *node) noexcept {
+        storage_.free_obj(const_cast<Node *>(node));
+    }
+
+    void destroy(const Node *node) noexcept {
+        if (node == nullptr)
+            return;
+
+        destroy(node->left_);
+        destroy(node->right_);
+        free_node(node);
+    }
+
+    // Builds a node from key, left and right, rotating when their heights
+    // differ by two.
+    const Node *balance(const KeyT &key, const Node *left, const Node *right) {
+        if (height_of(left) > height_of(right) + 1) {
+            retire(left);
+            if (height_of(left->left_) >= height_of(left->right_))
+                return make_node(left->key_, left->left_,
+                                 make_node(key, left->right_, right));
+
+            const Node *middle = left->right_;
+            retire(middle);
+            return make_node(middle->key_,
+                             make_node(left->key_, left->left_, middle->left_),
+                             make_node(key, middle->right_, right));
+        }
+
+        if (height_of(right) > height_of(left) + 1) {
+            retire(right);
+            if (height_of(right->right_) >= height_of(right->left_))
+                return make_node(right->key_,
+                                 make_node(key, left, right->left_),
+                                 right->right_);
+
+            const Node *middle = right->left_;
+            retire(middle);
+            return make_node(middle->key_,
+                             make_node(key, left, middle->left_),
+                             make_node(right->key_, middle->right_,
+                                       right->right_));
+        }
+
+        return make_node(key, left, right);
+    }
+
+    const Node *insert_copy(const Node *node, const KeyT &key,
+                            bool &inserted) {
+        if (node == nullptr) {
+            inserted = true;
+            return make_node(key, nullptr, nullptr);
+        }
+
+        if (comp_(key, node->key_)) {
+            const Node *left = insert_copy(node->left_, key, inserted);
+            if (!inserted)
+                return node;
+            retire(node);
+            return balance(node->key_, left, node->right_);
+        }
+
+        if (comp_(node->key_, key)) {
+            const Node *right = insert_copy(node->right_, key, inserted);
+            if (!inserted)
+                return node;
+            retire(node);
+            return balance(node->key_, node->left_, right);
+        }
+
+        return node;
+    }
+
+    const Node *erase_copy(const Node *node, const KeyT &key, bool &erased) {
+        if (node == nullptr)
+            return nullptr;
+
+        if (comp_(key, node->key_)) {
+            const Node *left = erase_copy(node->left_, key, erased);
+            if (!erased)
+                return node;
+            retire(node);
+            return balance(node->key_, left, node->right_);
+        }
+
+        if (comp_(node->key_, key)) {
+            const Node *right = erase_copy(node->right_, key, erased);
+            if (!erased)
+                return node;
+            retire(node);
+            return balance(node->key_, node->left_, right);
+        }
+
+        erased = true;
+        retire(node);
+        if (node->left_ == nullptr)
+            return node->right_;
+        if (node->right_ == nullptr)
+            return node->left_;
+
+        const Node *successor = nullptr;
+        const Node *right = erase_min(node->right_, successor);
+        return balance(successor->key_, node->left_, right);
+    }
+
+    const Node *erase_min(const Node *node, const Node *&min) {
+        retire(node);
+        if (node->left_ == nullptr) {
+            min = node;
+            return node->right_;
+        }
+
+        const Node *left = erase_min(node->left_, min);
+        return balance(node->key_, left, node->right_);
+    }
+
+    [[no_unique_address]] Compare comp_;
+    std::atomic<const Node *> root_{nullptr};
+    std::atomic<std::uint64_t> epoch_{1};
+    mutable std::array<ReaderSlot, max_readers> slots_;
+
+    std::mutex write_mutex_;
+    Storage<Node> storage_;
+    std::vector<const Node *> created_;
+    std::vector<const Node *> pending_;
+    std::vector<Retired> retired_;
+}; // class ConcurrentAVLtree
+
+} // namespace trees
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "input_file.hpp"
+#include "process_queries.hpp"
+
+namespace query {
+
+class parse_error final : public std::runtime_error {
+public:
+    parse_error(const std::string &what, size_t offset)
+        : std::runtime_error(what + " at offset " + std::to_string(offset)),
+          offset_(offset) {}
+
+    size_t offset() const noexcept { return offset_; }
+
+private:
+    size_t offset_;
+};
+
+enum class Command : char { insert = 'k', request = 'q', erase = 'd' };
+
+// Struct-of-arrays form of a command stream: one byte per command and its
+// keys packed one after another (two for a request, one otherwise).
+// Iterating it yields Query objects, so get_answers accepts it unchanged.
+template <typename KeyT> class CommandBuffer final {
+public:
+    class Iterator final {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Query<KeyT>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        Iterator() = default;
+
+        const Query<KeyT> &operator*() const noexcept { return current_; }
+
+        const Query<KeyT> *operator->() const noexcept { return &current_; }
+
+        Iterator &operator++() noexcept {
+            key_ += key_count(buffer_->commands_[command_]);
+            command_++;
+            load();
+            return *this;
+        }
+
+        void operator++(int) noexcept { ++*this; }
+
+        friend bool operator==(const Iterator &lhs,
+                               const Iterator &rhs) noexcept {
+            return lhs.command_ == rhs.command_;
+        }
+
+    private:
+        Iterator(const CommandBuffer &buffer, size_t command)
+            : buffer_(&buffer), command_(command) {
+            load();
+        }
+
+        void load() noexcept {
+            if (command_ >= buffer_->commands_.size())
+                return;
+
+            const KeyT *keys = buffer_->keys_.data() + key_;
+            switch (buffer_->commands_[command_]) {
+            case Command::insert:
+                current_.template emplace<Key<KeyT>>(keys[0]);
+                break;
+            case Command::request:
+                current_.template emplace<Request<KeyT>>(keys[0], keys[1]);
+                break;
+            case Command::erase:
+                current_.template emplace<Erase<KeyT>>(keys[0]);
+                break;
+            }
+        }
+
+        const CommandBuffer *buffer_ = nullptr;
+        size_t command_ = 0;
+        size_t key_ = 0;
+        Query<KeyT> current_;
+
+        friend class CommandBuffer;
+    }; // class Iterator
+
+    static constexpr size_t key_count(Command command) noexcept {
+        return command == Command::request ? 2 : 1;
+    }
+
+    void reserve(size_t commands, size_t keys) {
+        commands_.reserve(commands);
+        keys_.reserve(keys);
+    }
+
+    void push_back(Command command, KeyT key1, KeyT key2 = KeyT{}) {
+        commands_.push_back(command);
+        keys_.push_back(key1);
+        if (command == Command::request)
+            keys_.push_back(key2);
+    }
+
+    void clear() noexcept {
+        commands_.clear();
+        keys_.clear();
+    }
+
+    size_t size() const noexcept { return commands_.size(); }
+
+    bool empty() const noexcept { return commands_.empty(); }
+
+    const std::vector<Command> &commands() const noexcept { return commands_; }
+
+    const std::vector<KeyT> &keys() const noexcept { return keys_; }
+
+    Iterator begin() const noexcept { return Iterator{*this, 0}; }
+
+    Iterator end() const noexcept { return Iterator{*this, commands_.size()}; }
+
+private:
+    std::vector<Command> commands_;
+    std::vector<KeyT> keys_;
+}; // class CommandBuffer
+
+namespace details {
+inline bool is_space(char c) noexcept {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+           c == '\f';
+}
+
+inline const char *skip_spaces(const char *cur, const char *end) noexcept {
+    while (cur != end && is_space(*cur))
+        ++cur;
+    return cur;
+}
+
+// Returns nullptr when the key may continue past end and more input can
+// still arrive.
+template <typename KeyT>
+const char *parse_key(const char *cur, const char *end, bool at_eof,
+                      size_t offset, KeyT &key) {
+    const char *origin = cur;
+    cur = skip_spaces(cur, end);
+    if (cur == end) {
+        if (!at_eof)
+            return nullptr;
+        throw parse_error("Expected a key, got end of input",
+                          offset + (cur - origin));
+    }
+
+    const char *token_end = cur;
+    while (token_end != end && !is_space(*token_end))
+        ++token_end;
+    if (token_end == end && !at_eof)
+        return nullptr;
+
+    auto [ptr, ec] = std::from_chars(cur, token_end, key);
+    if (ec == std::errc::result_out_of_range)
+        throw parse_error("Key is out of range", offset + (cur - origin));
+    if (ec != std::errc{} || ptr != token_end)
+        throw parse_error("Malformed key", offset + (cur - origin));
+
+    return ptr;
+}
+} // namespace details
+
+// Parses the whole commands of [begin, end) and passes each one to
+// handler(command, key1, key2). Unless at_eof, a command that may go on
+// past end is left alone. Returns where parsing stopped; offset is the
+// position of begin in the whole input and only shows up in errors.
+template <typename KeyT, typename HandlerT>
+    requires std::is_arithmetic_v<KeyT>
+const char *parse_chunk(const char *begin, const char *end, bool at_eof,
+                        size_t offset, HandlerT &&handler) {
+    const char *cur = begin;
+
+    while (true) {
+        cur = details::skip_spaces(cur, end);
+        if (cur == end)
+            return cur;
+
+        const char *command_pos = cur;
+        size_t command_offset = offset + (command_pos - begin);
+        KeyT key1{};
+        KeyT key2{};
+        Command command{};
+
+        switch (*command_pos) {
+        case 'k':
+            command = Command::insert;
+            cur = details::parse_key(cur + 1, end, at_eof, command_offset + 1,
+                                     key1);
+            break;
+        case 'd':
+            command = Command::erase;
+            cur = details::parse_key(cur + 1, end, at_eof, command_offset + 1,
+                                     key1);
+            break;
+        case 'q':
+            command = Command::request;
+            cur = details::parse_key(cur + 1, end, at_eof, command_offset + 1,
+                                     key1);
+            if (cur != nullptr)
+                cur = details::parse_key(cur, end, at_eof,
+                                         offset + (cur - begin), key2);
+            break;
+        default:
+            throw parse_error(std::string("Unknown command '") +
+                                  *command_pos + "'",
+                              command_offset);
+        }
+
+        if (cur == nullptr)
+            return command_pos;
+
+        handler(command, key1, key2);
+    }
+}
+
+template <typename KeyT>
+    requires std::is_arithmetic_v<KeyT>
+void parse_commands(CommandBuffer<KeyT> &buffer, std::string_view text) {
+    // Every command takes at least four characters ("k 1\n"), and keys are
+    // densest in requests: two in six characters ("q 1 2\n").
+    buffer.reserve(buffer.size() + text.size() / 4,
+                   buffer.keys().size() + text.size() / 3);
+
+    parse_chunk<KeyT>(text.data(), text.data() + text.size(), true, 0,
+                      [&buffer](Command command, KeyT key1, KeyT key2) {
+                          buffer.push_back(command, key1, key2);
+                      });
+}
+
+template <typename KeyT>
+CommandBuffer<KeyT> parse_commands(std::string_view text) {
+    CommandBuffer<KeyT> buffer;
+    parse_commands(buffer, text);
+    return buffer;
+}
+
+template <typename KeyT> CommandBuffer<KeyT> parse_file(const char *path) {
+    InputFile file{path};
+    return parse_commands<KeyT>(file.view());
+}
+
+} // namespace query
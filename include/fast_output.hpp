@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <span>
+#include <system_error>
+#include <vector>
+
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#define QUERY_HAS_WRITE 1
+#endif
+
+namespace query {
+
+// text: decimal answers followed by a space, and a newline at the end.
+// binary: every answer as a 64-bit unsigned integer in native byte order,
+// with nothing in between.
+enum class OutputFormat { text, binary };
+
+inline constexpr size_t default_output_buffer_size = 1U << 16;
+
+// Collects formatted answers in one reusable buffer and hands it to the
+// sink whole, either an ostream or (where available) a file descriptor
+// written with write(2).
+class AnswerWriter final {
+public:
+    explicit AnswerWriter(std::ostream &out,
+                          OutputFormat format = OutputFormat::text,
+                          size_t capacity = default_output_buffer_size)
+        : out_(&out), format_(format) {
+        buffer_.resize(std::max(capacity, max_answer_size));
+    }
+
+#ifdef QUERY_HAS_WRITE
+    explicit AnswerWriter(int fd, OutputFormat format = OutputFormat::text,
+                          size_t capacity = default_output_buffer_size)
+        : fd_(fd), format_(format) {
+        buffer_.resize(std::max(capacity, max_answer_size));
+    }
+#endif
+
+    AnswerWriter(const AnswerWriter &) = delete;
+    AnswerWriter &operator=(const AnswerWriter &) = delete;
+
+    ~AnswerWriter() {
+        try {
+            flush();
+        } catch (...) {
+        }
+    }
+
+    OutputFormat format() const noexcept { return format_; }
+
+    void put(size_t answer) {
+        if (buffer_.size() - used_ < max_answer_size)
+            flush();
+
+        char *begin = buffer_.data() + used_;
+        if (format_ == OutputFormat::binary) {
+            std::uint64_t value = answer;
+            std::memcpy(begin, &value, sizeof(value));
+            used_ += sizeof(value);
+            return;
+        }
+
+        auto result = std::to_chars(begin, begin + max_answer_size - 1, answer);
+        *result.ptr++ = ' ';
+        used_ += result.ptr - begin;
+    }
+
+    void put(std::span<const size_t> answers) {
+        for (size_t answer : answers)
+            put(answer);
+    }
+
+    // Ends the text line and flushes.
+    void finish() {
+        if (format_ == OutputFormat::text) {
+            if (used_ == buffer_.size())
+                flush();
+            buffer_[used_++] = '\n';
+        }
+        flush();
+    }
+
+    void flush() {
+        if (out_ != nullptr) {
+            out_->write(buffer_.data(), static_cast<std::streamsize>(used_));
+            out_->flush();
+            used_ = 0;
+            return;
+        }
+
+#ifdef QUERY_HAS_WRITE
+        const char *data = buffer_.data();
+        while (used_ > 0) {
+            ssize_t written = ::write(fd_, data, used_);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                used_ = 0;
+                throw std::system_error(errno, std::generic_category(),
+                                        "write");
+            }
+            data += written;
+            used_ -= static_cast<size_t>(written);
+        }
+#endif
+    }
+
+private:
+    static constexpr size_t max_answer_size = 24;
+
+    std::ostream *out_ = nullptr;
+    int fd_ = -1;
+    OutputFormat format_;
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+}; // class AnswerWriter
+
+} // namespace query
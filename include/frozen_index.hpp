@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+namespace trees {
+namespace details {
+
+inline constexpr size_t cache_line_size = 64;
+
+template <typename T> struct CacheAlignedAllocator {
+    using value_type = T;
+
+    CacheAlignedAllocator() = default;
+
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U> &) noexcept {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(::operator new(
+            n * sizeof(T), std::align_val_t{cache_line_size}));
+    }
+
+    void deallocate(T *ptr, size_t) noexcept {
+        ::operator delete(ptr, std::align_val_t{cache_line_size});
+    }
+
+    friend bool operator==(const CacheAlignedAllocator &,
+                           const CacheAlignedAllocator &) noexcept {
+        return true;
+    }
+};
+
+inline void prefetch(const void *ptr) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(ptr);
+#else
+    (void)ptr;
+#endif
+}
+
+} // namespace details
+
+// Immutable set of keys for read-only phases. Keys are stored in Eytzinger
+// order (the children of slot k are 2k and 2k + 1), so the top levels of
+// every search share a few cache lines and the slots four levels down are
+// adjacent and can be prefetched together. Each slot also keeps the rank of
+// its key, which makes a range count two branchless descents.
+template <typename KeyT = int, typename Compare = std::less<KeyT>>
+class FrozenIndex final {
+    using rank_t = std::uint32_t;
+
+public:
+    using key_type = KeyT;
+    using value_type = KeyT;
+    using size_type = size_t;
+    using key_compare = Compare;
+
+    FrozenIndex() = default;
+
+    // [first, last) has to be strictly ascending under comp.
+    template <std::forward_iterator ForwardIt>
+    FrozenIndex(ForwardIt first, ForwardIt last, const Compare &comp = Compare{})
+        : FrozenIndex(first, static_cast<size_t>(std::distance(first, last)),
+                      comp) {}
+
+    // Takes the first n keys of first.
+    template <typename InputIt>
+    FrozenIndex(InputIt first, size_t n, const Compare &comp = Compare{})
+        : comp_(comp) {
+        if (n >= std::numeric_limits<rank_t>::max())
+            throw std::length_error("Too many keys for a frozen index");
+
+        keys_.resize(n + 1);
+        ranks_.resize(n + 1);
+        rank_t rank = 0;
+        fill(1, first, rank);
+    }
+
+    size_t size() const noexcept { return ranks_.empty() ? 0 : ranks_.size() - 1; }
+
+    bool empty() const noexcept { return size() == 0; }
+
+    Compare key_comp() const { return comp_; }
+
+    bool contains(const KeyT &key) const {
+        size_t slot = search<false>(key);
+        return slot != 0 && !comp_(key, keys_[slot]);
+    }
+
+    // Number of keys that are less than key.
+    size_t rank(const KeyT &key) const { return rank_of(search<false>(key)); }
+
+    size_t get_num_elems_from_diapason(const KeyT &key1,
+                                       const KeyT &key2) const {
+        if (comp_(key2, key1))
+            return 0;
+
+        return rank_of(search<true>(key2)) - rank_of(search<false>(key1));
+    }
+
+    std::vector<size_t>
+    count_ranges(std::span<const std::pair<KeyT, KeyT>> ranges) const {
+        std::vector<size_t> answers;
+        answers.reserve(ranges.size());
+        for (auto &[key1, key2] : ranges)
+            answers.push_back(get_num_elems_from_diapason(key1, key2));
+        return answers;
+    }
+
+private:
+    // Slots four levels below k start at 16k; that many keys of 4 bytes
+    // fill one cache line.
+    static constexpr size_t prefetch_stride =
+        std::bit_floor(std::max<size_t>(details::cache_line_size / sizeof(KeyT), 1));
+
+    template <typename InputIt>
+    void fill(size_t slot, InputIt &first, rank_t &rank) {
+        if (slot >= keys_.size())
+            return;
+
+        fill(2 * slot, first, rank);
+        keys_[slot] = *first;
+        ++first;
+        ranks_[slot] = rank++;
+        fill(2 * slot + 1, first, rank);
+    }
+
+    // The slot of the first key that is not less than key (greater than key
+    // when inclusive), or 0 if there is none. The descent always runs to the
+    // bottom; the last turn to the left is recovered from the bits of the
+    // final position.
+    template <bool inclusive> size_t search(const KeyT &key) const {
+        size_t n = size();
+        size_t slot = 1;
+
+        while (slot <= n) {
+            details::prefetch(keys_.data() + std::min(slot * prefetch_stride, n));
+            bool right = inclusive ? !comp_(key, keys_[slot])
+                                   : comp_(keys_[slot], key);
+            slot = 2 * slot + right;
+        }
+
+        return slot >> (std::countr_one(slot) + 1);
+    }
+
+    size_t rank_of(size_t slot) const noexcept {
+        return slot == 0 ? size() : ranks_[slot];
+    }
+
+    [[no_unique_address]] Compare comp_;
+    std::vector<KeyT, details::CacheAlignedAllocator<KeyT>> keys_;
+    std::vector<rank_t> ranks_;
+}; // class FrozenIndex
+
+// Copies the keys of tree into a frozen index; the tree stays as it is.
+template <typename KeyT, typename Compare, template <typename> class Storage,
+          tree_aggregate<KeyT> Aggregate, typename Stats>
+FrozenIndex<KeyT, Compare>
+freeze(const AVLtree<KeyT, Compare, Storage, Aggregate, Stats> &tree) {
+    return FrozenIndex<KeyT, Compare>{tree.begin(), tree.size(),
+                                      tree.key_comp()};
+}
+
+} // namespace trees
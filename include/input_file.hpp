@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define QUERY_HAS_POSIX 1
+#endif
+
+namespace query {
+
+// How the mapped pages will be read, passed on to the kernel as a hint.
+enum class Access { sequential, random };
+
+// Read-only view of a whole file: mapped when the platform allows it,
+// read into memory otherwise.
+class InputFile final {
+public:
+    explicit InputFile(const char *path, Access access = Access::sequential) {
+#ifdef QUERY_HAS_POSIX
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), path);
+
+        struct stat info {};
+        if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+            size_ = static_cast<size_t>(info.st_size);
+            if (size_ == 0) {
+                ::close(fd);
+                return;
+            }
+
+            void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                ::close(fd);
+                ::madvise(data, size_,
+                          access == Access::sequential ? MADV_SEQUENTIAL
+                                                       : MADV_RANDOM);
+                mapped_ = static_cast<const char *>(data);
+                return;
+            }
+        }
+        ::close(fd);
+#else
+        (void)access;
+#endif
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            throw std::runtime_error(std::string("Cannot open ") + path);
+
+        buffer_.assign(std::istreambuf_iterator<char>(in),
+                       std::istreambuf_iterator<char>());
+        size_ = buffer_.size();
+    }
+
+    InputFile(const InputFile &) = delete;
+    InputFile &operator=(const InputFile &) = delete;
+
+    ~InputFile() {
+#ifdef QUERY_HAS_POSIX
+        if (mapped_ != nullptr)
+            ::munmap(const_cast<char *>(mapped_), size_);
+#endif
+    }
+
+    std::string_view view() const noexcept {
+        return {mapped_ != nullptr ? mapped_ : buffer_.data(), size_};
+    }
+
+private:
+    const char *mapped_ = nullptr;
+    std::vector<char> buffer_;
+    size_t size_ = 0;
+};
+
+} // namespace query
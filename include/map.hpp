@@ -0,0 +1,193 @@
+#pragma once
+
+#include <functional>
+#include <memory_resource>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "tree.hpp"
+
+namespace trees {
+namespace details {
+
+// Orders map entries by their keys. It is transparent, so the tree under a
+// map can be searched with a bare key; heterogeneous keys reach the user's
+// comparator only when that one is transparent too.
+template <typename KeyT, typename ValueT, typename Compare>
+struct EntryCompare final {
+    using is_transparent = void;
+
+    template <typename L, typename R>
+    bool operator()(const L &lhs, const R &rhs) const {
+        return comp_(key_of(lhs), key_of(rhs));
+    }
+
+    template <typename T> static const auto &key_of(const T &value) noexcept {
+        if constexpr (std::is_same_v<T, std::pair<const KeyT, ValueT>>)
+            return value.first;
+        else
+            return value;
+    }
+
+    [[no_unique_address]] Compare comp_;
+};
+
+} // namespace details
+
+// Ordered map on the AVL tree: every node holds a std::pair<const KeyT,
+// ValueT>, so a record takes one lookup and one allocation. Values are
+// constructed in place and may be move-only. Subtree counters give the same
+// order statistics as AVLtree.
+template <typename KeyT, typename ValueT, typename Compare = std::less<KeyT>,
+          template <typename> class Storage = details::ArenaStorage>
+class AVLmap final {
+    using Tree = AVLtree<std::pair<const KeyT, ValueT>,
+                         details::EntryCompare<KeyT, ValueT, Compare>, Storage>;
+
+public:
+    using key_type = KeyT;
+    using mapped_type = ValueT;
+    using value_type = std::pair<const KeyT, ValueT>;
+    using size_type = size_t;
+    using key_compare = Compare;
+    using iterator = typename Tree::iterator;
+    using const_iterator = typename Tree::const_iterator;
+
+    AVLmap() = default;
+
+    explicit AVLmap(std::pmr::memory_resource *resource) : tree_(resource) {}
+
+    explicit AVLmap(const Compare &comp,
+                    std::pmr::memory_resource *resource =
+                        std::pmr::get_default_resource())
+        : tree_(typename Tree::key_compare{comp}, resource) {}
+
+    size_t size() const noexcept { return tree_.size(); }
+
+    bool empty() const noexcept { return tree_.empty(); }
+
+    int height() const noexcept { return tree_.height(); }
+
+    Compare key_comp() const { return tree_.key_comp().comp_; }
+
+    // Builds the entry from args before looking for its key, as std::map
+    // does; the entry is dropped if the key is already there.
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args) {
+        return tree_.emplace_node(std::forward<Args>(args)...);
+    }
+
+    std::pair<iterator, bool> insert(const value_type &entry) {
+        return tree_.try_emplace_node(entry.first, entry);
+    }
+
+    std::pair<iterator, bool> insert(value_type &&entry) {
+        return tree_.try_emplace_node(entry.first, std::move(entry));
+    }
+
+    // Leaves args untouched when the key is already there.
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const KeyT &key, Args&&... args) {
+        return tree_.try_emplace_node(
+            key, std::piecewise_construct, std::forward_as_tuple(key),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(KeyT &&key, Args&&... args) {
+        return tree_.try_emplace_node(
+            key, std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const KeyT &key, M &&value) {
+        auto result = try_emplace(key, std::forward<M>(value));
+        if (!result.second)
+            result.first->second = std::forward<M>(value);
+        return result;
+    }
+
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(KeyT &&key, M &&value) {
+        auto result = try_emplace(std::move(key), std::forward<M>(value));
+        if (!result.second)
+            result.first->second = std::forward<M>(value);
+        return result;
+    }
+
+    ValueT &operator[](const KeyT &key) {
+        return try_emplace(key).first->second;
+    }
+
+    ValueT &operator[](KeyT &&key) {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    ValueT &at(const KeyT &key) { return checked_find(key)->second; }
+
+    const ValueT &at(const KeyT &key) const {
+        return checked_find(key)->second;
+    }
+
+    iterator find(const KeyT &key) const { return tree_.find(key); }
+
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    iterator find(const K &key) const {
+        return tree_.find(key);
+    }
+
+    bool contains(const KeyT &key) const { return tree_.contains(key); }
+
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    bool contains(const K &key) const {
+        return tree_.contains(key);
+    }
+
+    iterator lower_bound(const KeyT &key) const {
+        return tree_.lower_bound(key);
+    }
+
+    iterator upper_bound(const KeyT &key) const {
+        return tree_.upper_bound(key);
+    }
+
+    iterator erase(iterator pos) noexcept { return tree_.erase(pos); }
+
+    size_t erase(const KeyT &key) { return tree_.erase(key); }
+
+    // Number of keys that are less than key.
+    size_t rank(const KeyT &key) const { return tree_.rank(key); }
+
+    // The entry with the k-th smallest key, counting from zero.
+    iterator nth(size_t k) const { return tree_.nth(k); }
+
+    size_t get_num_elems_from_diapason(const KeyT &key1,
+                                       const KeyT &key2) const {
+        return tree_.get_num_elems_from_diapason(key1, key2);
+    }
+
+    void clear() noexcept { tree_.clear(); }
+
+    void swap(AVLmap &other) noexcept { tree_.swap(other.tree_); }
+
+    iterator begin() const { return tree_.begin(); }
+
+    iterator end() const { return tree_.end(); }
+
+private:
+    iterator checked_find(const KeyT &key) const {
+        iterator it = find(key);
+        if (it == end())
+            throw std::out_of_range("Key is not in the map");
+        return it;
+    }
+
+    Tree tree_;
+}; // class AVLmap
+
+} // namespace trees
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <functional>
+#include <memory_resource>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+namespace trees {
+namespace details {
+
+// A key and the number of times it was inserted. Only the multiset changes
+// the count, so iterators hand it out read-only.
+template <typename KeyT> class CountedKey final {
+public:
+    explicit CountedKey(const KeyT &key) : key_(key) {}
+
+    CountedKey(const CountedKey &) = default;
+    CountedKey &operator=(const CountedKey &) = delete;
+
+    const KeyT &key() const noexcept { return key_; }
+
+    size_t count() const noexcept { return count_; }
+
+private:
+    KeyT key_;
+    size_t count_ = 1;
+
+    template <typename, typename, template <typename> class>
+    friend class trees::AVLmultiset;
+};
+
+template <typename KeyT, typename Compare> struct CountedCompare final {
+    using is_transparent = void;
+
+    template <typename L, typename R>
+    bool operator()(const L &lhs, const R &rhs) const {
+        return comp_(key_of(lhs), key_of(rhs));
+    }
+
+    template <typename T> static const auto &key_of(const T &value) noexcept {
+        if constexpr (std::is_same_v<T, CountedKey<KeyT>>)
+            return value.key();
+        else
+            return value;
+    }
+
+    [[no_unique_address]] Compare comp_;
+};
+
+// Sum of the counts, so that range queries count occurrences.
+template <typename KeyT> struct Occurrences final {
+    using value_type = size_t;
+
+    static size_t identity() noexcept { return 0; }
+
+    static size_t lift(const CountedKey<KeyT> &key) noexcept {
+        return key.count();
+    }
+
+    static size_t combine(size_t lhs, size_t rhs) noexcept { return lhs + rhs; }
+};
+
+} // namespace details
+
+// AVL tree that keeps every key once with the number of its occurrences.
+// Repeated keys cost no nodes, and size, rank and range counts are in
+// occurrences. Iteration visits distinct keys: it->key() and it->count().
+template <typename KeyT = int, typename Compare = std::less<KeyT>,
+          template <typename> class Storage = details::ArenaStorage>
+class AVLmultiset final {
+    using Tree = AVLtree<details::CountedKey<KeyT>,
+                         details::CountedCompare<KeyT, Compare>, Storage,
+                         details::Occurrences<KeyT>>;
+
+public:
+    using key_type = KeyT;
+    using value_type = details::CountedKey<KeyT>;
+    using size_type = size_t;
+    using key_compare = Compare;
+    using iterator = typename Tree::iterator;
+    using const_iterator = typename Tree::const_iterator;
+
+    AVLmultiset() = default;
+
+    explicit AVLmultiset(std::pmr::memory_resource *resource)
+        : tree_(resource) {}
+
+    explicit AVLmultiset(const Compare &comp,
+                         std::pmr::memory_resource *resource =
+                             std::pmr::get_default_resource())
+        : tree_(typename Tree::key_compare{comp}, resource) {}
+
+    // Number of occurrences of all keys.
+    size_t size() const noexcept {
+        return empty() ? 0 : tree_.root_->aggregate_;
+    }
+
+    size_t distinct_size() const noexcept { return tree_.size(); }
+
+    bool empty() const noexcept { return tree_.empty(); }
+
+    int height() const noexcept { return tree_.height(); }
+
+    Compare key_comp() const { return tree_.key_comp().comp_; }
+
+    // Adds one occurrence of key. Returns the iterator to its node.
+    iterator insert(const KeyT &key) { return insert(key, 1); }
+
+    iterator insert(const KeyT &key, size_t count) {
+        if (count == 0)
+            return find(key);
+
+        auto [it, inserted] = tree_.try_emplace_node(key, key);
+        tree_.modify_in_place(it, [&](value_type &entry) {
+            entry.count_ = inserted ? count : entry.count_ + count;
+        });
+        return it;
+    }
+
+    // Removes one occurrence of key. Returns whether there was one.
+    bool erase_one(const KeyT &key) {
+        iterator it = find(key);
+        if (it == end())
+            return false;
+
+        if (it->count() == 1)
+            tree_.erase(it);
+        else
+            tree_.modify_in_place(it, [](value_type &entry) { entry.count_--; });
+        return true;
+    }
+
+    // Removes all occurrences of key and returns their number.
+    size_t erase(const KeyT &key) {
+        iterator it = find(key);
+        if (it == end())
+            return 0;
+
+        size_t count = it->count();
+        tree_.erase(it);
+        return count;
+    }
+
+    iterator erase(iterator pos) noexcept { return tree_.erase(pos); }
+
+    size_t count(const KeyT &key) const {
+        iterator it = find(key);
+        return it == end() ? 0 : it->count();
+    }
+
+    iterator find(const KeyT &key) const { return tree_.find(key); }
+
+    bool contains(const KeyT &key) const { return tree_.contains(key); }
+
+    iterator lower_bound(const KeyT &key) const {
+        return tree_.lower_bound(key);
+    }
+
+    iterator upper_bound(const KeyT &key) const {
+        return tree_.upper_bound(key);
+    }
+
+    // Number of occurrences of keys that are less than key.
+    size_t rank(const KeyT &key) const {
+        if (empty() || !tree_.comp_(tree_.front_->key_, key))
+            return 0;
+
+        return tree_.aggregate(tree_.front_->key_.key(), key) - count(key);
+    }
+
+    // Number of occurrences of keys in [key1, key2].
+    size_t get_num_elems_from_diapason(const KeyT &key1,
+                                       const KeyT &key2) const {
+        return tree_.aggregate(key1, key2);
+    }
+
+    std::vector<size_t>
+    count_ranges(std::span<const std::pair<KeyT, KeyT>> ranges) const {
+        std::vector<size_t> answers;
+        answers.reserve(ranges.size());
+        for (auto &[key1, key2] : ranges)
+            answers.push_back(tree_.aggregate(key1, key2));
+        return answers;
+    }
+
+    void clear() noexcept { tree_.clear(); }
+
+    void swap(AVLmultiset &other) noexcept { tree_.swap(other.tree_); }
+
+    iterator begin() const { return tree_.begin(); }
+
+    iterator end() const { return tree_.end(); }
+
+private:
+    Tree tree_;
+}; // class AVLmultiset
+
+} // namespace trees
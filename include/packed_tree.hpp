@@ -0,0 +1,913 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TREES_HAS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace trees {
+namespace simd {
+
+enum class Level { scalar, sse2, avx2 };
+
+inline const char *name(Level level) noexcept {
+    switch (level) {
+    case Level::sse2:
+        return "sse2";
+    case Level::avx2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+// The best level this CPU supports.
+inline Level detected() noexcept {
+#ifdef TREES_HAS_X86_SIMD
+    static const Level level = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? Level::avx2 : Level::sse2;
+    }();
+    return level;
+#else
+    return Level::scalar;
+#endif
+}
+
+namespace details {
+inline std::atomic<Level> active_level{detected()};
+} // namespace details
+
+inline Level active() noexcept {
+    return details::active_level.load(std::memory_order_relaxed);
+}
+
+// Switches the node search of all packed trees, e.g. to compare the levels
+// in a benchmark. A level the CPU lacks falls back to the best one it has;
+// the level in use is returned.
+inline Level use(Level level) noexcept {
+    level = std::min(level, detected());
+    details::active_level.store(level, std::memory_order_relaxed);
+    return level;
+}
+
+namespace details {
+
+// Number of keys[0, n) that are less than key, or not greater than key when
+// inclusive. The vector versions read all width slots and mask out the ones
+// past n, so the slots have to be initialized.
+template <bool inclusive, typename KeyT>
+size_t count_scalar(const KeyT *keys, size_t n, KeyT key) noexcept {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++)
+        count += inclusive ? !(key < keys[i]) : keys[i] < key;
+    return count;
+}
+
+#ifdef TREES_HAS_X86_SIMD
+// The vector compares are signed; flipping the sign bit orders unsigned
+// keys the same way.
+template <typename KeyT> auto as_signed(KeyT key) noexcept {
+    using SignedT = std::make_signed_t<KeyT>;
+    if constexpr (std::is_unsigned_v<KeyT>)
+        return static_cast<SignedT>(key ^ (KeyT{1} << (sizeof(KeyT) * 8 - 1)));
+    else
+        return static_cast<SignedT>(key);
+}
+
+template <bool inclusive>
+size_t count_mask(std::uint32_t greater_mask, std::uint32_t less_mask,
+                  size_t n) noexcept {
+    std::uint32_t mask = inclusive ? ~greater_mask : less_mask;
+    return static_cast<size_t>(
+        std::popcount(mask & ((std::uint32_t{1} << n) - 1)));
+}
+
+template <bool inclusive, size_t width, typename KeyT>
+__attribute__((target("avx2"))) size_t
+count_avx2(const KeyT *keys, size_t n, KeyT key) noexcept {
+    constexpr size_t lanes = 32 / sizeof(KeyT);
+    static_assert(width % lanes == 0);
+
+    __m256i bias;
+    __m256i target;
+    if constexpr (sizeof(KeyT) == 4) {
+        bias = _mm256_set1_epi32(std::is_unsigned_v<KeyT> ? INT32_MIN : 0);
+        target = _mm256_set1_epi32(as_signed(key));
+    } else {
+        bias = _mm256_set1_epi64x(std::is_unsigned_v<KeyT> ? INT64_MIN : 0);
+        target = _mm256_set1_epi64x(as_signed(key));
+    }
+
+    std::uint32_t greater = 0;
+    std::uint32_t less = 0;
+    for (size_t i = 0; i < width; i += lanes) {
+        __m256i slots =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        if constexpr (std::is_unsigned_v<KeyT>)
+            slots = _mm256_xor_si256(slots, bias);
+
+        std::uint32_t bits;
+        if constexpr (sizeof(KeyT) == 4)
+            bits = static_cast<std::uint32_t>(_mm256_movemask_ps(
+                _mm256_castsi256_ps(inclusive ? _mm256_cmpgt_epi32(slots, target)
+                                              : _mm256_cmpgt_epi32(target, slots))));
+        else
+            bits = static_cast<std::uint32_t>(_mm256_movemask_pd(
+                _mm256_castsi256_pd(inclusive ? _mm256_cmpgt_epi64(slots, target)
+                                              : _mm256_cmpgt_epi64(target, slots))));
+        (inclusive ? greater : less) |= bits << i;
+    }
+    return count_mask<inclusive>(greater, less, n);
+}
+
+// SSE2 has no 64-bit compare, so it only takes 32-bit keys.
+template <bool inclusive, size_t width, typename KeyT>
+size_t count_sse2(const KeyT *keys, size_t n, KeyT key) noexcept {
+    static_assert(sizeof(KeyT) == 4 && width % 4 == 0);
+
+    const __m128i bias =
+        _mm_set1_epi32(std::is_unsigned_v<KeyT> ? INT32_MIN : 0);
+    const __m128i target = _mm_set1_epi32(as_signed(key));
+
+    std::uint32_t greater = 0;
+    std::uint32_t less = 0;
+    for (size_t i = 0; i < width; i += 4) {
+        __m128i slots =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+        if constexpr (std::is_unsigned_v<KeyT>)
+            slots = _mm_xor_si128(slots, bias);
+
+        auto bits = static_cast<std::uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(
+            inclusive ? _mm_cmpgt_epi32(slots, target)
+                      : _mm_cmpgt_epi32(target, slots))));
+        (inclusive ? greater : less) |= bits << i;
+    }
+    return count_mask<inclusive>(greater, less, n);
+}
+#endif
+
+template <bool inclusive, size_t width, typename KeyT>
+size_t count_keys(const KeyT *keys, size_t n, KeyT key) noexcept {
+#ifdef TREES_HAS_X86_SIMD
+    if constexpr (sizeof(KeyT) == 4 || sizeof(KeyT) == 8) {
+        Level level = active();
+        if (level == Level::avx2)
+            return count_avx2<inclusive, width>(keys, n, key);
+        if constexpr (sizeof(KeyT) == 4)
+            if (level == Level::sse2)
+                return count_sse2<inclusive, width>(keys, n, key);
+    }
+#endif
+    return count_scalar<inclusive>(keys, n, key);
+}
+
+} // namespace details
+} // namespace simd
+
+// B+ tree for integral keys. Leaves hold up to 16 keys and are all on one
+// level; inner nodes hold up to 17 children together with the number of
+// keys below each of them, so ranks and range counts stay O(log n). A node
+// is searched by comparing the key with all of its slots at once and
+// counting the smaller ones, which replaces one hard-to-predict branch per
+// AVL level with a few branch-free steps per node. Any insert or erase
+// invalidates all iterators.
+template <std::integral KeyT = int> class PackedTree final {
+public:
+    static constexpr size_t leaf_keys = 16;
+    static constexpr size_t inner_children = leaf_keys + 1;
+
+private:
+    static constexpr size_t min_leaf_keys = leaf_keys / 2;
+    static constexpr size_t min_children = inner_children / 2;
+
+    // Below 2^32 keys with at least min_children children per inner node.
+    static constexpr size_t max_height = 16;
+
+    struct alignas(64) Leaf final {
+        KeyT keys_[leaf_keys] = {};
+        Leaf *next_ = nullptr;
+        std::uint32_t count_ = 0;
+    }; // struct Leaf
+
+    // keys_[i] separates children_[i] and children_[i + 1]: the keys below
+    // children_[i] are less than it and the keys below children_[i + 1] are
+    // not. The children are leaves on the last inner level.
+    struct alignas(64) Inner final {
+        KeyT keys_[leaf_keys] = {};
+        void *children_[inner_children] = {};
+        std::uint32_t sizes_[inner_children] = {};
+        std::uint32_t count_ = 0;
+    }; // struct Inner
+
+    struct Split final {
+        KeyT key_{};
+        void *node_ = nullptr;
+        std::uint32_t size_ = 0;
+    }; // struct Split
+
+    // The inner nodes an insert passes and the child taken in each, from the
+    // root down, and the place of the key in the leaf at the end.
+    struct Path final {
+        Inner *inners_[max_height];
+        size_t children_[max_height];
+        size_t depth_ = 0;
+        Leaf *leaf_ = nullptr;
+        size_t pos_ = 0;
+    }; // struct Path
+
+    // The nodes an insert splits off, allocated before the tree changes so
+    // that a failed allocation leaves it as it was. Unused ones are freed.
+    class NewNodes final {
+    public:
+        explicit NewNodes(PackedTree &tree) noexcept : tree_(tree) {}
+
+        NewNodes(const NewNodes &) = delete;
+        NewNodes &operator=(const NewNodes &) = delete;
+
+        ~NewNodes() {
+            if (leaf_ != nullptr)
+                tree_.free_node(leaf_);
+            while (count_ > 0)
+                tree_.free_node(inners_[--count_]);
+        }
+
+        void add_leaf() { leaf_ = tree_.template make_node<Leaf>(); }
+
+        void add_inner() {
+            inners_[count_] = tree_.template make_node<Inner>();
+            count_++;
+        }
+
+        Leaf *take_leaf() noexcept { return std::exchange(leaf_, nullptr); }
+
+        Inner *take_inner() noexcept { return inners_[--count_]; }
+
+    private:
+        PackedTree &tree_;
+        Leaf *leaf_ = nullptr;
+        Inner *inners_[max_height] = {};
+        size_t count_ = 0;
+    }; // class NewNodes
+
+    class Iterator final {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = KeyT;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        Iterator() = default;
+
+        Iterator &operator++() noexcept {
+            if (++pos_ == leaf_->count_) {
+                leaf_ = leaf_->next_;
+                pos_ = 0;
+            }
+            return *this;
+        }
+
+        Iterator operator++(int) noexcept {
+            Iterator it(*this);
+            ++(*this);
+            return it;
+        }
+
+        const KeyT &operator*() const {
+            if (leaf_ == nullptr)
+                throw std::out_of_range("Iterator is at post-end");
+
+            return leaf_->keys_[pos_];
+        }
+
+        const KeyT *operator->() const { return &**this; }
+
+        friend bool operator==(const Iterator &lhs,
+                               const Iterator &rhs) noexcept = default;
+
+    private:
+        Iterator(const Leaf *leaf, size_t pos) noexcept : leaf_(leaf), pos_(pos) {
+            if (leaf_ != nullptr && pos_ == leaf_->count_) {
+                leaf_ = leaf_->next_;
+                pos_ = 0;
+            }
+        }
+
+        const Leaf *leaf_ = nullptr;
+        size_t pos_ = 0;
+
+        friend class PackedTree;
+    }; // class Iterator
+
+public:
+    using key_type = KeyT;
+    using value_type = KeyT;
+    using size_type = size_t;
+    using key_compare = std::less<KeyT>;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+
+    PackedTree() = default;
+
+    explicit PackedTree(std::pmr::memory_resource *resource)
+        : resource_(resource) {}
+
+    PackedTree(const PackedTree &other) : resource_(other.resource_) {
+        if (other.root_ == nullptr)
+            return;
+
+        root_ = clone(other.root_, other.height_);
+        height_ = other.height_;
+        size_ = other.size_;
+        Leaf *prev = nullptr;
+        link_leaves(root_, height_, prev);
+    }
+
+    PackedTree(PackedTree &&other) noexcept
+        : resource_(other.resource_),
+          root_(std::exchange(other.root_, nullptr)),
+          height_(std::exchange(other.height_, 0)),
+          size_(std::exchange(other.size_, 0)),
+          leaves_(std::exchange(other.leaves_, 0)),
+          inners_(std::exchange(other.inners_, 0)) {}
+
+    PackedTree &operator=(const PackedTree &other) {
+        if (this != &other) {
+            PackedTree copy{other};
+            swap(copy);
+        }
+        return *this;
+    }
+
+    PackedTree &operator=(PackedTree &&other) noexcept {
+        if (this != &other) {
+            clear();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ~PackedTree() { clear(); }
+
+    void swap(PackedTree &other) noexcept {
+        std::swap(resource_, other.resource_);
+        std::swap(root_, other.root_);
+        std::swap(height_, other.height_);
+        std::swap(size_, other.size_);
+        std::swap(leaves_, other.leaves_);
+        std::swap(inners_, other.inners_);
+    }
+
+    void clear() noexcept {
+        if (root_ != nullptr)
+            destroy(root_, height_);
+        root_ = nullptr;
+        height_ = 0;
+        size_ = 0;
+    }
+
+    size_t size() const noexcept { return size_; }
+
+    bool empty() const noexcept { return size_ == 0; }
+
+    // Number of node levels, leaves included.
+    int height() const noexcept { return static_cast<int>(height_); }
+
+    size_t memory_usage() const noexcept {
+        return leaves_ * sizeof(Leaf) + inners_ * sizeof(Inner);
+    }
+
+    bool insert(const KeyT &key) {
+        if (root_ == nullptr) {
+            Leaf *leaf = make_node<Leaf>();
+            leaf->keys_[0] = key;
+            leaf->count_ = 1;
+            root_ = leaf;
+            height_ = 1;
+            size_ = 1;
+            return true;
+        }
+
+        if (size_ >= std::numeric_limits<std::uint32_t>::max())
+            throw std::length_error("Packed tree is out of subtree counts");
+
+        Path path;
+        if (find_path(key, path))
+            return false;
+
+        size_t splits = count_splits(path);
+        NewNodes nodes{*this};
+        if (splits > 0)
+            nodes.add_leaf();
+        for (size_t i = 1; i < splits; i++)
+            nodes.add_inner();
+        if (splits == height_)
+            nodes.add_inner();
+
+        Split split = insert_along(path, key, nodes);
+        size_++;
+        if (split.node_ != nullptr) {
+            Inner *root = nodes.take_inner();
+            root->keys_[0] = split.key_;
+            root->children_[0] = root_;
+            root->children_[1] = split.node_;
+            root->sizes_[0] = static_cast<std::uint32_t>(size_ - split.size_);
+            root->sizes_[1] = split.size_;
+            root->count_ = 2;
+            root_ = root;
+            height_++;
+        }
+        return true;
+    }
+
+    size_t erase(const KeyT &key) {
+        if (root_ == nullptr || !erase_from(root_, height_, key))
+            return 0;
+
+        size_--;
+        if (height_ == 1) {
+            if (as_leaf(root_).count_ == 0) {
+                free_node(static_cast<Leaf *>(root_));
+                root_ = nullptr;
+                height_ = 0;
+            }
+        } else if (as_inner(root_).count_ == 1) {
+            Inner *root = static_cast<Inner *>(root_);
+            root_ = root->children_[0];
+            height_--;
+            free_node(root);
+        }
+        return 1;
+    }
+
+    bool contains(const KeyT &key) const noexcept {
+        if (root_ == nullptr)
+            return false;
+
+        const Leaf &leaf = find_leaf(key);
+        size_t pos = count_less(leaf, key);
+        return pos < leaf.count_ && leaf.keys_[pos] == key;
+    }
+
+    Iterator lower_bound(const KeyT &key) const noexcept {
+        if (root_ == nullptr)
+            return end();
+
+        const Leaf &leaf = find_leaf(key);
+        return Iterator{&leaf, count_less(leaf, key)};
+    }
+
+    // Number of keys that are less than key.
+    size_t rank(const KeyT &key) const noexcept {
+        return count_before<false>(key);
+    }
+
+    // The k-th smallest key, counting from zero.
+    const KeyT &select(size_t k) const {
+        if (k >= size_)
+            throw std::out_of_range("Index is out of tree size");
+
+        const void *node = root_;
+        for (size_t level = height_; level > 1; level--) {
+            const Inner &inner = as_inner(node);
+            size_t i = 0;
+            while (k >= inner.sizes_[i])
+                k -= inner.sizes_[i++];
+            node = inner.children_[i];
+        }
+        return as_leaf(node).keys_[k];
+    }
+
+    size_t get_num_elems_from_diapason(const KeyT &key1,
+                                       const KeyT &key2) const noexcept {
+        if (key2 < key1)
+            return 0;
+
+        return count_before<true>(key2) - count_before<false>(key1);
+    }
+
+    std::vector<size_t>
+    count_ranges(std::span<const std::pair<KeyT, KeyT>> ranges) const {
+        std::vector<size_t> answers;
+        answers.reserve(ranges.size());
+        for (auto &[key1, key2] : ranges)
+            answers.push_back(get_num_elems_from_diapason(key1, key2));
+        return answers;
+    }
+
+    Iterator begin() const noexcept {
+        if (root_ == nullptr)
+            return end();
+
+        const void *node = root_;
+        for (size_t level = height_; level > 1; level--)
+            node = as_inner(node).children_[0];
+        return Iterator{&as_leaf(node), 0};
+    }
+
+    Iterator end() const noexcept { return Iterator{}; }
+
+private:
+    static Leaf &as_leaf(void *node) noexcept { return *static_cast<Leaf *>(node); }
+
+    static const Leaf &as_leaf(const void *node) noexcept {
+        return *static_cast<const Leaf *>(node);
+    }
+
+    static Inner &as_inner(void *node) noexcept {
+        return *static_cast<Inner *>(node);
+    }
+
+    static const Inner &as_inner(const void *node) noexcept {
+        return *static_cast<const Inner *>(node);
+    }
+
+    static size_t count_less(const Leaf &leaf, const KeyT &key) noexcept {
+        return simd::details::count_keys<false, leaf_keys>(leaf.keys_,
+                                                           leaf.count_, key);
+    }
+
+    static size_t child_index(const Inner &inner, const KeyT &key) noexcept {
+        return simd::details::count_keys<true, leaf_keys>(
+            inner.keys_, inner.count_ - 1, key);
+    }
+
+    const Leaf &find_leaf(const KeyT &key) const noexcept {
+        const void *node = root_;
+        for (size_t level = height_; level > 1; level--) {
+            const Inner &inner = as_inner(node);
+            node = inner.children_[child_index(inner, key)];
+        }
+        return as_leaf(node);
+    }
+
+    // Number of keys that are less than key, or not greater when inclusive.
+    template <bool inclusive>
+    size_t count_before(const KeyT &key) const noexcept {
+        if (root_ == nullptr)
+            return 0;
+
+        size_t count = 0;
+        const void *node = root_;
+        for (size_t level = height_; level > 1; level--) {
+            const Inner &inner = as_inner(node);
+            size_t i = child_index(inner, key);
+            for (size_t j = 0; j < i; j++)
+                count += inner.sizes_[j];
+            node = inner.children_[i];
+        }
+
+        const Leaf &leaf = as_leaf(node);
+        return count + simd::details::count_keys<inclusive, leaf_keys>(
+                           leaf.keys_, leaf.count_, key);
+    }
+
+    template <typename NodeT> NodeT *make_node() {
+        void *memory = resource_->allocate(sizeof(NodeT), alignof(NodeT));
+        (std::is_same_v<NodeT, Leaf> ? leaves_ : inners_)++;
+        return new (memory) NodeT{};
+    }
+
+    template <typename NodeT> void free_node(NodeT *node) noexcept {
+        (std::is_same_v<NodeT, Leaf> ? leaves_ : inners_)--;
+        resource_->deallocate(node, sizeof(NodeT), alignof(NodeT));
+    }
+
+    void destroy(void *node, size_t level) noexcept {
+        if (level == 1) {
+            free_node(static_cast<Leaf *>(node));
+            return;
+        }
+
+        Inner *inner = static_cast<Inner *>(node);
+        for (size_t i = 0; i < inner->count_; i++)
+            destroy(inner->children_[i], level - 1);
+        free_node(inner);
+    }
+
+    void *clone(const void *node, size_t level) {
+        if (level == 1) {
+            Leaf *leaf = make_node<Leaf>();
+            *leaf = as_leaf(node);
+            return leaf;
+        }
+
+        const Inner &inner = as_inner(node);
+        Inner *copy = make_node<Inner>();
+        *copy = inner;
+        copy->count_ = 0;
+        try {
+            for (; copy->count_ < inner.count_; copy->count_++)
+                copy->children_[copy->count_] =
+                    clone(inner.children_[copy->count_], level - 1);
+        } catch (...) {
+            destroy(copy, level);
+            throw;
+        }
+        return copy;
+    }
+
+    void link_leaves(void *node, size_t level, Leaf *&prev) noexcept {
+        if (level == 1) {
+            Leaf *leaf = static_cast<Leaf *>(node);
+            if (prev != nullptr)
+                prev->next_ = leaf;
+            leaf->next_ = nullptr;
+            prev = leaf;
+            return;
+        }
+
+        Inner &inner = as_inner(node);
+        for (size_t i = 0; i < inner.count_; i++)
+            link_leaves(inner.children_[i], level - 1, prev);
+    }
+
+    static void insert_key(Leaf &leaf, size_t pos, const KeyT &key) noexcept {
+        std::copy_backward(leaf.keys_ + pos, leaf.keys_ + leaf.count_,
+                           leaf.keys_ + leaf.count_ + 1);
+        leaf.keys_[pos] = key;
+        leaf.count_++;
+    }
+
+    static void erase_key(Leaf &leaf, size_t pos) noexcept {
+        std::copy(leaf.keys_ + pos + 1, leaf.keys_ + leaf.count_,
+                  leaf.keys_ + pos);
+        leaf.count_--;
+    }
+
+    // Puts child at pos; key separates it from the child before it, or from
+    // the one after it when pos is 0.
+    static void insert_child(Inner &inner, size_t pos, const KeyT &key,
+                             void *child, std::uint32_t size) noexcept {
+        size_t sep = pos == 0 ? 0 : pos - 1;
+        std::copy_backward(inner.keys_ + sep, inner.keys_ + inner.count_ - 1,
+                           inner.keys_ + inner.count_);
+        std::copy_backward(inner.children_ + pos, inner.children_ + inner.count_,
+                           inner.children_ + inner.count_ + 1);
+        std::copy_backward(inner.sizes_ + pos, inner.sizes_ + inner.count_,
+                           inner.sizes_ + inner.count_ + 1);
+        inner.keys_[sep] = key;
+        inner.children_[pos] = child;
+        inner.sizes_[pos] = size;
+        inner.count_++;
+    }
+
+    // Removes the child at pos together with the key that insert_child
+    // would have put with it.
+    static void erase_child(Inner &inner, size_t pos) noexcept {
+        size_t sep = pos == 0 ? 0 : pos - 1;
+        std::copy(inner.keys_ + sep + 1, inner.keys_ + inner.count_ - 1,
+                  inner.keys_ + sep);
+        std::copy(inner.children_ + pos + 1, inner.children_ + inner.count_,
+                  inner.children_ + pos);
+        std::copy(inner.sizes_ + pos + 1, inner.sizes_ + inner.count_,
+                  inner.sizes_ + pos);
+        inner.count_--;
+    }
+
+    static std::uint32_t subtree_size(const Inner &inner) noexcept {
+        std::uint32_t size = 0;
+        for (size_t i = 0; i < inner.count_; i++)
+            size += inner.sizes_[i];
+        return size;
+    }
+
+    // Walks down to the leaf for key, noting the inner nodes on the way and
+    // the child taken in each. Returns whether key is already there.
+    bool find_path(const KeyT &key, Path &path) noexcept {
+        void *node = root_;
+        for (size_t level = height_; level > 1; level--) {
+            Inner &inner = as_inner(node);
+            size_t i = child_index(inner, key);
+            path.inners_[path.depth_] = &inner;
+            path.children_[path.depth_] = i;
+            path.depth_++;
+            node = inner.children_[i];
+        }
+
+        path.leaf_ = static_cast<Leaf *>(node);
+        path.pos_ = count_less(*path.leaf_, key);
+        return path.pos_ < path.leaf_->count_ &&
+               path.leaf_->keys_[path.pos_] == key;
+    }
+
+    // Number of nodes that split when a key goes in at the end of path: the
+    // leaf and the inner nodes above it up to the first one with room, none
+    // if the leaf has room.
+    static size_t count_splits(const Path &path) noexcept {
+        if (path.leaf_->count_ < leaf_keys)
+            return 0;
+
+        size_t splits = 1;
+        for (size_t d = path.depth_;
+             d > 0 && path.inners_[d - 1]->count_ == inner_children; d--)
+            splits++;
+        return splits;
+    }
+
+    // Puts key at the end of path and carries the splits up; nodes holds
+    // the new nodes they take.
+    Split insert_along(const Path &path, const KeyT &key,
+                       NewNodes &nodes) noexcept {
+        Split split = insert_into_leaf(*path.leaf_, path.pos_, key, nodes);
+
+        for (size_t d = path.depth_; d > 0; d--) {
+            Inner &inner = *path.inners_[d - 1];
+            size_t i = path.children_[d - 1];
+            inner.sizes_[i]++;
+            if (split.node_ == nullptr)
+                continue;
+            inner.sizes_[i] -= split.size_;
+
+            Split up;
+            Inner *target = &inner;
+            size_t pos = i + 1;
+            if (inner.count_ == inner_children) {
+                up = split_inner(inner, nodes.take_inner());
+                if (pos > inner.count_) {
+                    target = static_cast<Inner *>(up.node_);
+                    pos -= inner.count_;
+                }
+            }
+
+            insert_child(*target, pos, split.key_, split.node_, split.size_);
+            if (up.node_ != nullptr)
+                up.size_ = subtree_size(as_inner(up.node_));
+            split = up;
+        }
+        return split;
+    }
+
+    static Split insert_into_leaf(Leaf &leaf, size_t pos, const KeyT &key,
+                                  NewNodes &nodes) noexcept {
+        if (leaf.count_ < leaf_keys) {
+            insert_key(leaf, pos, key);
+            return {};
+        }
+
+        Leaf *right = nodes.take_leaf();
+
+        size_t half = leaf_keys / 2;
+        std::copy(leaf.keys_ + half, leaf.keys_ + leaf_keys, right->keys_);
+        right->count_ = static_cast<std::uint32_t>(leaf_keys - half);
+        leaf.count_ = static_cast<std::uint32_t>(half);
+        right->next_ = leaf.next_;
+        leaf.next_ = right;
+
+        if (pos <= half)
+            insert_key(leaf, pos, key);
+        else
+            insert_key(*right, pos - half, key);
+
+        return {right->keys_[0], right, right->count_};
+    }
+
+    // Moves the upper half of the children to the empty node right; the key
+    // that separated the halves goes up.
+    static Split split_inner(Inner &inner, Inner *right) noexcept {
+        size_t half = inner.count_ / 2;
+        size_t moved = inner.count_ - half;
+
+        std::copy(inner.keys_ + half, inner.keys_ + inner.count_ - 1,
+                  right->keys_);
+        std::copy(inner.children_ + half, inner.children_ + inner.count_,
+                  right->children_);
+        std::copy(inner.sizes_ + half, inner.sizes_ + inner.count_,
+                  right->sizes_);
+        right->count_ = static_cast<std::uint32_t>(moved);
+        inner.count_ = static_cast<std::uint32_t>(half);
+
+        return {inner.keys_[half - 1], right, 0};
+    }
+
+    bool erase_from(void *node, size_t level, const KeyT &key) {
+        if (level == 1) {
+            Leaf &leaf = as_leaf(node);
+            size_t pos = count_less(leaf, key);
+            if (pos == leaf.count_ || leaf.keys_[pos] != key)
+                return false;
+
+            erase_key(leaf, pos);
+            return true;
+        }
+
+        Inner &inner = as_inner(node);
+        size_t i = child_index(inner, key);
+        if (!erase_from(inner.children_[i], level - 1, key))
+            return false;
+
+        inner.sizes_[i]--;
+        if (level == 2 ? as_leaf(inner.children_[i]).count_ < min_leaf_keys
+                       : as_inner(inner.children_[i]).count_ < min_children)
+            fix_underflow(inner, i, level - 1);
+        return true;
+    }
+
+    // Refills the child at i from a sibling that can spare an entry, or
+    // merges it with a sibling.
+    void fix_underflow(Inner &parent, size_t i, size_t level) noexcept {
+        bool has_left = i > 0;
+        bool has_right = i + 1 < parent.count_;
+
+        if (level == 1) {
+            Leaf &child = as_leaf(parent.children_[i]);
+
+            if (has_left && as_leaf(parent.children_[i - 1]).count_ > min_leaf_keys) {
+                Leaf &left = as_leaf(parent.children_[i - 1]);
+                insert_key(child, 0, left.keys_[--left.count_]);
+                parent.keys_[i - 1] = child.keys_[0];
+                parent.sizes_[i - 1]--;
+                parent.sizes_[i]++;
+                return;
+            }
+
+            if (has_right && as_leaf(parent.children_[i + 1]).count_ > min_leaf_keys) {
+                Leaf &right = as_leaf(parent.children_[i + 1]);
+                child.keys_[child.count_++] = right.keys_[0];
+                erase_key(right, 0);
+                parent.keys_[i] = right.keys_[0];
+                parent.sizes_[i + 1]--;
+                parent.sizes_[i]++;
+                return;
+            }
+
+            size_t k = has_left ? i - 1 : i;
+            Leaf &left = as_leaf(parent.children_[k]);
+            Leaf *right = static_cast<Leaf *>(parent.children_[k + 1]);
+            std::copy(right->keys_, right->keys_ + right->count_,
+                      left.keys_ + left.count_);
+            left.count_ += right->count_;
+            left.next_ = right->next_;
+            parent.sizes_[k] += parent.sizes_[k + 1];
+            erase_child(parent, k + 1);
+            free_node(right);
+            return;
+        }
+
+        Inner &child = as_inner(parent.children_[i]);
+
+        if (has_left && as_inner(parent.children_[i - 1]).count_ > min_children) {
+            Inner &left = as_inner(parent.children_[i - 1]);
+            size_t last = left.count_ - 1;
+            std::uint32_t size = left.sizes_[last];
+            insert_child(child, 0, parent.keys_[i - 1], left.children_[last], size);
+            parent.keys_[i - 1] = left.keys_[last - 1];
+            left.count_--;
+            parent.sizes_[i - 1] -= size;
+            parent.sizes_[i] += size;
+            return;
+        }
+
+        if (has_right && as_inner(parent.children_[i + 1]).count_ > min_children) {
+            Inner &right = as_inner(parent.children_[i + 1]);
+            std::uint32_t size = right.sizes_[0];
+            insert_child(child, child.count_, parent.keys_[i], right.children_[0],
+                         size);
+            parent.keys_[i] = right.keys_[0];
+            erase_child(right, 0);
+            parent.sizes_[i + 1] -= size;
+            parent.sizes_[i] += size;
+            return;
+        }
+
+        size_t k = has_left ? i - 1 : i;
+        Inner &left = as_inner(parent.children_[k]);
+        Inner *right = static_cast<Inner *>(parent.children_[k + 1]);
+        left.keys_[left.count_ - 1] = parent.keys_[k];
+        std::copy(right->keys_, right->keys_ + right->count_ - 1,
+                  left.keys_ + left.count_);
+        std::copy(right->children_, right->children_ + right->count_,
+                  left.children_ + left.count_);
+        std::copy(right->sizes_, right->sizes_ + right->count_,
+                  left.sizes_ + left.count_);
+        left.count_ += right->count_;
+        parent.sizes_[k] += parent.sizes_[k + 1];
+        erase_child(parent, k + 1);
+        free_node(right);
+    }
+
+    std::pmr::memory_resource *resource_ = std::pmr::get_default_resource();
+    void *root_ = nullptr;
+    size_t height_ = 0;
+    size_t size_ = 0;
+    size_t leaves_ = 0;
+    size_t inners_ = 0;
+}; // class PackedTree
+
+} // namespace trees
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <span>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "process_queries.hpp"
+
+namespace query {
+
+// Fixed set of worker threads for fork-join loops. The calling thread takes
+// part in every loop, so a pool of size 1 has no workers at all. Only one
+// loop may run on a pool at a time.
+class ThreadPool final {
+public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+        threads = std::max<size_t>(threads, 1);
+        workers_.reserve(threads - 1);
+        try {
+            for (size_t i = 1; i < threads; i++)
+                workers_.emplace_back([this] { work(); });
+        } catch (...) {
+            stop();
+            throw;
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() { stop(); }
+
+    size_t size() const noexcept { return workers_.size() + 1; }
+
+    // Splits [0, count) into at most size() chunks of at least min_chunk
+    // indices, calls func(first, last) for each and returns when all are
+    // done. The first exception thrown by func is rethrown here.
+    template <typename FuncT>
+    void parallel_for(size_t count, size_t min_chunk, FuncT &&func) {
+        size_t chunks =
+            std::clamp<size_t>(count / std::max<size_t>(min_chunk, 1), 1,
+                               size());
+        if (chunks == 1) {
+            if (count > 0)
+                func(size_t{0}, count);
+            return;
+        }
+
+        Loop loop{[&](size_t chunk) {
+                      func(count * chunk / chunks,
+                           count * (chunk + 1) / chunks);
+                  },
+                  chunks};
+
+        loop_.store(&loop);
+        generation_++;
+        generation_.notify_all();
+
+        run_chunks(loop);
+        wait_for(loop.finished_, chunks);
+
+        // A worker that woke up late either sees no loop or is counted in
+        // busy_ and has to leave it before loop goes away.
+        loop_.store(nullptr);
+        wait_for(busy_, 0);
+
+        if (loop.error_)
+            std::rethrow_exception(loop.error_);
+    }
+
+private:
+    struct Loop final {
+        Loop(std::function<void(size_t)> chunk, size_t chunks)
+            : chunk_(std::move(chunk)), chunks_(chunks) {}
+
+        std::function<void(size_t)> chunk_;
+        size_t chunks_;
+        std::atomic<size_t> next_{0};
+        std::atomic<size_t> finished_{0};
+        std::atomic<bool> failed_{false};
+        std::exception_ptr error_;
+    };
+
+    static void wait_for(std::atomic<size_t> &value, size_t expected) {
+        for (size_t cur = value.load(); cur != expected; cur = value.load())
+            value.wait(cur);
+    }
+
+    static void run_chunks(Loop &loop) {
+        for (size_t chunk = loop.next_++; chunk < loop.chunks_;
+             chunk = loop.next_++) {
+            try {
+                loop.chunk_(chunk);
+            } catch (...) {
+                if (!loop.failed_.exchange(true))
+                    loop.error_ = std::current_exception();
+            }
+
+            if (++loop.finished_ == loop.chunks_)
+                loop.finished_.notify_all();
+        }
+    }
+
+    void work() {
+        size_t seen = 0;
+
+        while (true) {
+            generation_.wait(seen);
+            seen = generation_.load();
+            if (stopping_.load())
+                return;
+
+            busy_++;
+            if (Loop *loop = loop_.load())
+                run_chunks(*loop);
+            if (--busy_ == 0)
+                busy_.notify_all();
+        }
+    }
+
+    void stop() noexcept {
+        stopping_.store(true);
+        generation_++;
+        generation_.notify_all();
+
+        for (auto &worker : workers_)
+            worker.join();
+        workers_.clear();
+    }
+
+    std::vector<std::thread> workers_;
+    std::atomic<Loop *> loop_{nullptr};
+    std::atomic<size_t> generation_{0};
+    std::atomic<size_t> busy_{0};
+    std::atomic<bool> stopping_{false};
+}; // class ThreadPool
+
+// Below this many requests a run is answered on the calling thread: waking
+// the pool costs more than the range counts themselves.
+inline constexpr size_t min_parallel_run = 1024;
+
+// Gives the same answers as get_answers. Commands that change the tree are
+// applied in order on the calling thread; runs of requests between them are
+// split among the pool's threads, each answering its part on a copy of
+// distance, and the answers are stored in their original order.
+template <typename KeyT, typename TreeT, typename DistanceT, typename Iter>
+std::vector<size_t> get_answers_parallel(TreeT &tree, Iter begin, Iter end,
+                                         DistanceT distance,
+                                         ThreadPool &pool) {
+    std::vector<size_t> answers;
+    std::vector<std::pair<KeyT, KeyT>> batch;
+
+    for (auto it = begin; it != end;) {
+        batch.clear();
+        for (; it != end; ++it) {
+            auto request = std::get_if<Request<KeyT>>(&*it);
+            if (request == nullptr)
+                break;
+            batch.emplace_back(request->key1_, request->key2_);
+        }
+
+        size_t offset = answers.size();
+        answers.resize(offset + batch.size());
+
+        pool.parallel_for(
+            batch.size(), min_parallel_run, [&](size_t first, size_t last) {
+                DistanceT local = distance;
+                size_t out = offset + first;
+                answer_requests<KeyT>(
+                    tree,
+                    std::span<const std::pair<KeyT, KeyT>>{batch}.subspan(
+                        first, last - first),
+                    local, [&](size_t count) { answers[out++] = count; });
+            });
+
+        if (it != end) {
+            std::visit(
+                CallQueryProcess<KeyT, TreeT, DistanceT>{tree, answers,
+                                                         distance},
+                *it);
+            ++it;
+        }
+    }
+
+    return answers;
+}
+
+} // namespace query
@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory_resource>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace trees {
+
+// AVL tree that keeps its old versions. snapshot() returns an immutable view
+// of the current keys in O(1); an update copies only the nodes on its path,
+// so versions share everything else. Nodes are reference counted: a snapshot
+// stays valid after the tree changes or is destroyed, and only the memory
+// resource has to outlive it. Reference counts are atomic, so snapshots may
+// be read and dropped on other threads while the tree is being updated.
+template <typename KeyT = int, typename Compare = std::less<KeyT>>
+class PersistentAVLtree final {
+    struct Node final {
+        Node(const KeyT &key, const Node *left, const Node *right)
+            : key_(key), left_(left), right_(right),
+              height_(1 + std::max(height_of(left), height_of(right))),
+              size_(1 + size_of(left) + size_of(right)) {}
+
+        KeyT key_;
+        const Node *left_;
+        const Node *right_;
+        int height_;
+        size_t size_;
+        mutable std::atomic<size_t> refs_{1};
+    }; // struct Node
+
+    // Owns one reference to a node. Children links inside nodes own one
+    // reference each as well.
+    class NodeRef final {
+    public:
+        NodeRef() = default;
+
+        NodeRef(const Node *node, std::pmr::memory_resource *resource) noexcept
+            : node_(node), resource_(resource) {}
+
+        static NodeRef share(const Node *node,
+                             std::pmr::memory_resource *resource) noexcept {
+            acquire(node);
+            return NodeRef{node, resource};
+        }
+
+        NodeRef(const NodeRef &other) noexcept
+            : node_(other.node_), resource_(other.resource_) {
+            acquire(node_);
+        }
+
+        NodeRef(NodeRef &&other) noexcept
+            : node_(std::exchange(other.node_, nullptr)),
+              resource_(other.resource_) {}
+
+        NodeRef &operator=(NodeRef other) noexcept {
+            std::swap(node_, other.node_);
+            std::swap(resource_, other.resource_);
+            return *this;
+        }
+
+        ~NodeRef() { release(node_, resource_); }
+
+        const Node *get() const noexcept { return node_; }
+
+        std::pmr::memory_resource *resource() const noexcept {
+            return resource_;
+        }
+
+    private:
+        const Node *node_ = nullptr;
+        std::pmr::memory_resource *resource_ = nullptr;
+    }; // class NodeRef
+
+public:
+    using key_type = KeyT;
+    using value_type = KeyT;
+    using size_type = size_t;
+    using key_compare = Compare;
+
+    static constexpr size_t node_size = sizeof(Node);
+
+    // Immutable view of the tree at the moment it was taken. Copies share the
+    // nodes.
+    class Snapshot final {
+    public:
+        Snapshot() = default;
+
+        size_t size() const noexcept { return size_of(root_.get()); }
+
+        bool empty() const noexcept { return root_.get() == nullptr; }
+
+        int height() const noexcept { return height_of(root_.get()); }
+
+        bool contains(const KeyT &key) const {
+            return find(root_.get(), key, comp_);
+        }
+
+        // Number of keys that are less than key.
+        size_t rank(const KeyT &key) const {
+            return count_less(root_.get(), key, comp_);
+        }
+
+        // The k-th smallest key, counting from zero.
+        const KeyT &select(size_t k) const { return select_key(root_.get(), k); }
+
+        size_t get_num_elems_from_diapason(const KeyT &key1,
+                                           const KeyT &key2) const {
+            return count_diapason(root_.get(), key1, key2, comp_);
+        }
+
+    private:
+        Snapshot(const NodeRef &root, const Compare &comp)
+            : root_(root), comp_(comp) {}
+
+        NodeRef root_;
+        [[no_unique_address]] Compare comp_;
+
+        friend class PersistentAVLtree;
+    }; // class Snapshot
+
+    explicit PersistentAVLtree(std::pmr::memory_resource *resource =
+                                   std::pmr::get_default_resource())
+        : PersistentAVLtree(Compare{}, resource) {}
+
+    explicit PersistentAVLtree(const Compare &comp,
+                               std::pmr::memory_resource *resource =
+                                   std::pmr::get_default_resource())
+        : comp_(comp), root_(nullptr, resource) {}
+
+    // Copies share all nodes, so copying is O(1).
+    PersistentAVLtree(const PersistentAVLtree &) = default;
+    PersistentAVLtree &operator=(const PersistentAVLtree &) = default;
+    PersistentAVLtree(PersistentAVLtree &&) noexcept = default;
+    PersistentAVLtree &operator=(PersistentAVLtree &&) noexcept = default;
+    ~PersistentAVLtree() = default;
+
+    Snapshot snapshot() const { return Snapshot{root_, comp_}; }
+
+    size_t size() const noexcept { return size_of(root_.get()); }
+
+    bool empty() const noexcept { return root_.get() == nullptr; }
+
+    int height() const noexcept { return height_of(root_.get()); }
+
+    Compare key_comp() const { return comp_; }
+
+    bool contains(const KeyT &key) const {
+        return find(root_.get(), key, comp_);
+    }
+
+    size_t rank(const KeyT &key) const {
+        return count_less(root_.get(), key, comp_);
+    }
+
+    const KeyT &select(size_t k) const { return select_key(root_.get(), k); }
+
+    size_t get_num_elems_from_diapason(const KeyT &key1,
+                                       const KeyT &key2) const {
+        return count_diapason(root_.get(), key1, key2, comp_);
+    }
+
+    bool insert(const KeyT &key) {
+        bool inserted = false;
+        NodeRef root = insert_copy(root_.get(), key, inserted);
+        if (inserted)
+            root_ = std::move(root);
+        return inserted;
+    }
+
+    size_t erase(const KeyT &key) {
+        bool erased = false;
+        NodeRef root = erase_copy(root_.get(), key, erased);
+        if (erased)
+            root_ = std::move(root);
+        return erased ? 1 : 0;
+    }
+
+private:
+    static int height_of(const Node *node) noexcept {
+        return node ? node->height_ : 0;
+    }
+
+    static size_t size_of(const Node *node) noexcept {
+        return node ? node->size_ : 0;
+    }
+
+    static void acquire(const Node *node) noexcept {
+        if (node != nullptr)
+            node->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void release(const Node *node,
+                        std::pmr::memory_resource *resource) noexcept {
+        while (node != nullptr &&
+               node->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            release(node->left_, resource);
+            const Node *right = node->right_;
+            node->~Node();
+            resource->deallocate(const_cast<Node *>(node), sizeof(Node),
+                                 alignof(Node));
+            node = right;
+        }
+    }
+
+    static bool find(const Node *cur, const KeyT &key, const Compare &comp) {
+        while (cur != nullptr) {
+            if (comp(key, cur->key_))
+                cur = cur->left_;
+            else if (comp(cur->key_, key))
+                cur = cur->right_;
+            else
+                return true;
+        }
+        return false;
+    }
+
+    static size_t count_less(const Node *cur, const KeyT &key,
+                             const Compare &comp) {
+        size_t count = 0;
+
+        while (cur != nullptr) {
+            if (comp(cur->key_, key)) {
+                count += size_of(cur->left_) + 1;
+                cur = cur->right_;
+            } else {
+                cur = cur->left_;
+            }
+        }
+        return count;
+    }
+
+    static size_t count_not_greater(const Node *cur, const KeyT &key,
+                                    const Compare &comp) {
+        size_t count = 0;
+
+        while (cur != nullptr) {
+            if (comp(key, cur->key_)) {
+                cur = cur->left_;
+            } else {
+                count += size_of(cur->left_) + 1;
+                cur = cur->right_;
+            }
+        }
+        return count;
+    }
+
+    static size_t count_diapason(const Node *root, const KeyT &key1,
+                                 const KeyT &key2, const Compare &comp) {
+        if (comp(key2, key1))
+            return 0;
+
+        return count_not_greater(root, key2, comp) -
+               count_less(root, key1, comp);
+    }
+
+    static const KeyT &select_key(const Node *cur, size_t k) {
+        while (cur != nullptr) {
+            size_t left = size_of(cur->left_);
+            if (k < left) {
+                cur = cur->left_;
+            } else if (k == left) {
+                return cur->key_;
+            } else {
+                k -= left + 1;
+                cur = cur->right_;
+            }
+        }
+
+        throw std::out_of_range("Index is out of tree size");
+    }
+
+    std::pmr::memory_resource *resource() const noexcept {
+        return root_.resource();
+    }
+
+    NodeRef make_node(const KeyT &key, const Node *left,
+                      const Node *right) const {
+        void *raw = resource()->allocate(sizeof(Node), alignof(Node));
+        const Node *node = nullptr;
+        try {
+            node = ::new (raw) Node(key, left, right);
+        } catch (...) {
+            resource()->deallocate(raw, sizeof(Node), alignof(Node));
+            throw;
+        }
+
+        acquire(left);
+        acquire(right);
+        return NodeRef{node, resource()};
+    }
+
+    // Builds a node from key, left and right, rotating when their heights
+    // differ by two. Nodes that are rotated away are dropped by the caller's
+    // references.
+    NodeRef balance(const KeyT &key, const Node *left,
+                    const Node *right) const {
+        if (height_of(left) > height_of(right) + 1) {
+            if (height_of(left->left_) >= height_of(left->right_))
+                return make_node(left->key_, left->left_,
+                                 make_node(key, left->right_, right).get());
+
+            const Node *middle = left->right_;
+            return make_node(
+                middle->key_,
+                make_node(left->key_, left->left_, middle->left_).get(),
+                make_node(key, middle->right_, right).get());
+        }
+
+        if (height_of(right) > height_of(left) + 1) {
+            if (height_of(right->right_) >= height_of(right->left_))
+                return make_node(right->key_,
+                                 make_node(key, left, right->left_).get(),
+                                 right->right_);
+
+            const Node *middle = right->left_;
+            return make_node(
+                middle->key_, make_node(key, left, middle->left_).get(),
+                make_node(right->key_, middle->right_, right->right_).get());
+        }
+
+        return make_node(key, left, right);
+    }
+
+    NodeRef insert_copy(const Node *node, const KeyT &key,
+                        bool &inserted) const {
+        if (node == nullptr) {
+            inserted = true;
+            return make_node(key, nullptr, nullptr);
+        }
+
+        if (comp_(key, node->key_)) {
+            NodeRef left = insert_copy(node->left_, key, inserted);
+            return inserted ? balance(node->key_, left.get(), node->right_)
+                            : NodeRef{};
+        }
+
+        if (comp_(node->key_, key)) {
+            NodeRef right = insert_copy(node->right_, key, inserted);
+            return inserted ? balance(node->key_, node->left_, right.get())
+                            : NodeRef{};
+        }
+
+        return NodeRef{};
+    }
+
+    NodeRef erase_copy(const Node *node, const KeyT &key, bool &erased) const {
+        if (node == nullptr)
+            return NodeRef{};
+
+        if (comp_(key, node->key_)) {
+            NodeRef left = erase_copy(node->left_, key, erased);
+            return erased ? balance(node->key_, left.get(), node->right_)
+                          : NodeRef{};
+        }
+
+        if (comp_(node->key_, key)) {
+            NodeRef right = erase_copy(node->right_, key, erased);
+            return erased ? balance(node->key_, node->left_, right.get())
+                          : NodeRef{};
+        }
+
+        erased = true;
+        if (node->left_ == nullptr)
+            return NodeRef::share(node->right_, resource());
+        if (node->right_ == nullptr)
+            return NodeRef::share(node->left_, resource());
+
+        const Node *successor = nullptr;
+        NodeRef right = erase_min(node->right_, successor);
+        return balance(successor->key_, node->left_, right.get());
+    }
+
+    NodeRef erase_min(const Node *node, const Node *&min) const {
+        if (node->left_ == nullptr) {
+            min = node;
+            return NodeRef::share(node->right_, resource());
+        }
+
+        NodeRef left = erase_min(node->left_, min);
+        return balance(node->key_, left.get(), node->right_);
+    }
+
+    [[no_unique_address]] Compare comp_;
+    NodeRef root_;
+}; // class PersistentAVLtree
+
+} // namespace trees
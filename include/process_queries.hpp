@@ -1,9 +1,14 @@
 #pragma once
 
+#include <concepts>
 #include <iostream>
+#include <span>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#include "fast_output.hpp"
+
 namespace query {
 template <typename KeyT> class Key final {
 public:
@@ -24,7 +29,17 @@ public:
     KeyT key2_;
 };
 
-template <typename KeyT> using Query = std::variant<Key<KeyT>, Request<KeyT>>;
+template <typename KeyT> class Erase final {
+public:
+    Erase() {}
+    Erase(KeyT key) : key_(key) {}
+
+public:
+    KeyT key_;
+};
+
+template <typename KeyT>
+using Query = std::variant<Key<KeyT>, Request<KeyT>, Erase<KeyT>>;
 
 template <typename KeyT>
 bool process_input(std::vector<Query<KeyT>> &queries, std::istream &in) {
@@ -54,12 +69,29 @@ bool process_input(std::vector<Query<KeyT>> &queries, std::istream &in) {
             Query<KeyT> v;
             v.template emplace<Request<KeyT>>(temp1, temp2);
             queries.push_back(std::move(v));
+        } else if (command == 'd') {
+            in >> temp1;
+            if (!in.good())
+                return false;
+
+            Query<KeyT> v;
+            v.template emplace<Erase<KeyT>>(temp1);
+            queries.push_back(std::move(v));
         } else {
             return false;
         }
     }
 }
 
+// Multisets drop one occurrence of the key, as each insert added one.
+template <typename TreeT, typename KeyT>
+void erase_command(TreeT &tree, const KeyT &key) {
+    if constexpr (requires { tree.erase_one(key); })
+        tree.erase_one(key);
+    else
+        tree.erase(key);
+}
+
 template <typename KeyT, typename TreeT, typename DistanceT>
 struct CallQueryProcess final {
     void operator()(const Key<KeyT> &key) { tree.insert(key.key_); }
@@ -68,15 +100,108 @@ struct CallQueryProcess final {
         answers.push_back(distance(tree, request.key1_, request.key2_));
     }
 
+    void operator()(const Erase<KeyT> &erase) {
+        erase_command(tree, erase.key_);
+    }
+
     TreeT &tree;
     std::vector<size_t> &answers;
     DistanceT distance;
 };
 
+// A distance that can also answer a whole run of requests at once.
+template <typename DistanceT, typename TreeT, typename KeyT>
+concept BatchDistance =
+    requires(DistanceT distance, TreeT &tree,
+             std::span<const std::pair<KeyT, KeyT>> ranges) {
+        { distance(tree, ranges) } -> std::convertible_to<std::vector<size_t>>;
+    };
+
+// Shorter runs are answered one by one: sorting the endpoints does not pay off.
+inline constexpr size_t min_batch_size = 16;
+
+struct RangeCount final {
+    template <typename TreeT, typename KeyT>
+    size_t operator()(TreeT &tree, const KeyT &key1, const KeyT &key2) const {
+        return tree.get_num_elems_from_diapason(key1, key2);
+    }
+
+    template <typename TreeT, typename KeyT>
+    std::vector<size_t>
+    operator()(TreeT &tree,
+               std::span<const std::pair<KeyT, KeyT>> ranges) const {
+        return tree.count_ranges(ranges);
+    }
+};
+
+// Answers requests from a read-only index built from the tree, such as
+// trees::freeze(tree). Inserts and erases still go to the tree, so the
+// answers are only right while the commands leave the keys unchanged.
+template <typename IndexT> struct IndexCount final {
+    template <typename TreeT, typename KeyT>
+    size_t operator()(TreeT &, const KeyT &key1, const KeyT &key2) const {
+        return index.get_num_elems_from_diapason(key1, key2);
+    }
+
+    template <typename TreeT, typename KeyT>
+    std::vector<size_t>
+    operator()(TreeT &, std::span<const std::pair<KeyT, KeyT>> ranges) const {
+        return index.count_ranges(ranges);
+    }
+
+    const IndexT &index;
+};
+
+// Answers a run of requests in order, through one batch call when the
+// distance supports it and the run is long enough.
+template <typename KeyT, typename TreeT, typename DistanceT, typename OutputT>
+void answer_requests(TreeT &tree,
+                     std::span<const std::pair<KeyT, KeyT>> requests,
+                     DistanceT &distance, OutputT &&output) {
+    if constexpr (BatchDistance<DistanceT, TreeT, KeyT>) {
+        if (requests.size() >= min_batch_size) {
+            for (auto count : distance(tree, requests))
+                output(count);
+            return;
+        }
+    }
+
+    for (auto &[key1, key2] : requests)
+        output(distance(tree, key1, key2));
+}
+
 template <typename KeyT, typename TreeT, typename DistanceT, typename Iter>
 std::vector<size_t> get_answers(TreeT &tree, Iter begin, Iter end,
                                 DistanceT distance) {
     std::vector<size_t> answers;
+
+    if constexpr (BatchDistance<DistanceT, TreeT, KeyT>) {
+        std::vector<std::pair<KeyT, KeyT>> batch;
+
+        for (auto it = begin; it != end;) {
+            batch.clear();
+            for (; it != end; ++it) {
+                auto request = std::get_if<Request<KeyT>>(&*it);
+                if (request == nullptr)
+                    break;
+                batch.emplace_back(request->key1_, request->key2_);
+            }
+
+            answer_requests<KeyT>(tree, batch, distance, [&](size_t count) {
+                answers.push_back(count);
+            });
+
+            if (it != end) {
+                std::visit(CallQueryProcess<KeyT, TreeT, DistanceT>{
+                               tree, answers, distance},
+                           *it);
+                ++it;
+            }
+        }
+
+        return answers;
+    }
+
     for (auto it = begin; it != end; ++it) {
         std::visit(
             CallQueryProcess<KeyT, TreeT, DistanceT>{tree, answers, distance},
@@ -85,10 +210,14 @@ std::vector<size_t> get_answers(TreeT &tree, Iter begin, Iter end,
     return answers;
 }
 
-void print_answers(std::vector<size_t> &answer_tree) {
-    for (auto &elem : answer_tree) {
-        std::cout << elem << " ";
-    }
-    std::cout << std::endl;
+inline void print_answers(const std::vector<size_t> &answer_tree,
+                          AnswerWriter &writer) {
+    writer.put(answer_tree);
+    writer.finish();
+}
+
+inline void print_answers(const std::vector<size_t> &answer_tree) {
+    AnswerWriter writer{std::cout};
+    print_answers(answer_tree, writer);
 }
 } // namespace query
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <istream>
+#include <span>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "fast_input.hpp"
+#include "fast_output.hpp"
+#include "process_queries.hpp"
+
+namespace query {
+
+inline constexpr size_t default_stream_buffer_size = 1U << 16;
+
+// Reads up to size bytes into data and returns how many were read; zero
+// means the end of input.
+class StreamReader final {
+public:
+    explicit StreamReader(std::istream &in) : in_(in) {}
+
+    size_t operator()(char *data, size_t size) {
+        in_.read(data, static_cast<std::streamsize>(size));
+        return static_cast<size_t>(in_.gcount());
+    }
+
+private:
+    std::istream &in_;
+};
+
+#ifdef QUERY_HAS_POSIX
+// Unlike StreamReader, returns as soon as some input is available, so a
+// slow producer gets its answers without waiting for a full buffer.
+class FdReader final {
+public:
+    explicit FdReader(int fd) : fd_(fd) {}
+
+    size_t operator()(char *data, size_t size) {
+        while (true) {
+            ssize_t got = ::read(fd_, data, size);
+            if (got >= 0)
+                return static_cast<size_t>(got);
+            if (errno != EINTR)
+                throw std::system_error(errno, std::generic_category(),
+                                        "read");
+        }
+    }
+
+private:
+    int fd_;
+};
+#endif
+
+// Parses, applies and answers commands chunk by chunk, so memory stays
+// bounded by buffer_size whatever the input length. Answers of a chunk are
+// flushed before the next chunk is read.
+template <typename KeyT, typename TreeT, typename ReaderT, typename DistanceT>
+void process_stream(TreeT &tree, ReaderT &&read, AnswerWriter &output,
+                    DistanceT distance,
+                    size_t buffer_size = default_stream_buffer_size) {
+    std::vector<char> input(buffer_size);
+    std::vector<std::pair<KeyT, KeyT>> requests;
+
+    auto answer = [&] {
+        answer_requests<KeyT>(tree, std::span{std::as_const(requests)},
+                              distance,
+                              [&output](size_t count) { output.put(count); });
+        requests.clear();
+    };
+
+    auto handle = [&](Command command, KeyT key1, KeyT key2) {
+        switch (command) {
+        case Command::request:
+            requests.emplace_back(key1, key2);
+            break;
+        case Command::insert:
+            answer();
+            tree.insert(key1);
+            break;
+        case Command::erase:
+            answer();
+            erase_command(tree, key1);
+            break;
+        }
+    };
+
+    size_t filled = 0;
+    size_t offset = 0;
+    bool at_eof = false;
+
+    while (!at_eof) {
+        size_t got = read(input.data() + filled, input.size() - filled);
+        at_eof = got == 0;
+        filled += got;
+
+        const char *begin = input.data();
+        const char *stop =
+            parse_chunk<KeyT>(begin, begin + filled, at_eof, offset, handle);
+        answer();
+        output.flush();
+
+        size_t consumed = stop - begin;
+        if (consumed == 0 && filled == input.size())
+            throw parse_error("Command does not fit into the input buffer",
+                              offset);
+
+        std::memmove(input.data(), stop, filled - consumed);
+        filled -= consumed;
+        offset += consumed;
+    }
+
+    output.finish();
+}
+
+} // namespace query
@@ -1,100 +1,582 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <compare>
+#include <cstddef>
 #include <functional>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <memory_resource>
+#include <new>
+#include <stdexcept>
 #include <string>
+#include <tuple>
 #include <stack>
+#include <type_traits>
 #include <algorithm>
+#include <bit>
 #include <iterator>
+#include <span>
+#include <utility>
+#include <vector>
 
 namespace trees {
 namespace details {
 
-template <typename T> class Builder final {
+template <typename T> class HeapStorage final {
 public:
+    static constexpr bool frees_in_bulk = false;
+
+    explicit HeapStorage(std::pmr::memory_resource *resource =
+                             std::pmr::get_default_resource()) noexcept
+        : resource_(resource) {}
+
+    HeapStorage(const HeapStorage &) = delete;
+    HeapStorage &operator=(const HeapStorage &) = delete;
+    HeapStorage(HeapStorage &&) noexcept = default;
+    HeapStorage &operator=(HeapStorage &&) noexcept = default;
+    ~HeapStorage() = default;
+
     template <class... Args> T *get_obj(Args&&... args) {
-        auto tmp = std::make_unique<T>(std::forward<Args>(args)...);
-        auto raw_ptr = tmp.get();
-        buffer_.push_back(std::move(tmp));
-        return raw_ptr;
+        void *raw = resource_->allocate(sizeof(T), alignof(T));
+        try {
+            return ::new (raw) T(std::forward<Args>(args)...);
+        } catch (...) {
+            resource_->deallocate(raw, sizeof(T), alignof(T));
+            throw;
+        }
     }
-    
-    auto move_begin() {
-        return std::make_move_iterator(buffer_.begin());
+
+    void free_obj(T *obj) noexcept {
+        obj->~T();
+        resource_->deallocate(obj, sizeof(T), alignof(T));
+    }
+
+    void reserve(size_t) {}
+
+    // Objects can move between heap storages that allocate from equal
+    // resources.
+    bool share(const HeapStorage &other, size_t) const noexcept {
+        return resource_->is_equal(*other.resource_);
+    }
+
+    std::pmr::memory_resource *resource() const noexcept { return resource_; }
+
+private:
+    std::pmr::memory_resource *resource_;
+}; // class HeapStorage
+
+// Hands out objects from contiguous blocks taken from the upstream resource.
+// Freed slots go to an intrusive free list and are reused by later get_obj
+// calls. Blocks are released only on destruction, and destruction does not
+// run destructors of objects that are still alive: that is the owner's job.
+// Blocks are reference counted, so storages can share them (see share) and
+// objects can move from one storage to another.
+template <typename T> class ArenaStorage final {
+    union Slot {
+        Slot *next_;
+        alignas(T) std::byte obj_[sizeof(T)];
+    };
+
+    // Lies at the start of each block, followed by the slots.
+    struct Block {
+        explicit Block(size_t size, std::pmr::memory_resource *resource)
+            : size_(size), resource_(resource) {}
+
+        std::atomic<size_t> refs_{1};
+        size_t size_;
+        std::pmr::memory_resource *resource_;
+    };
+
+    static constexpr size_t block_align = std::max(alignof(Block), alignof(Slot));
+    static constexpr size_t header_size =
+        (sizeof(Block) + block_align - 1) / block_align * block_align;
+
+    static constexpr size_t min_block_size = 64;
+    static constexpr size_t max_block_size = 1U << 16;
+
+    // share takes in at most this many slots per object that moves.
+    static constexpr size_t max_shared_slots = 4;
+
+public:
+    static constexpr bool frees_in_bulk = true;
+
+    explicit ArenaStorage(std::pmr::memory_resource *resource =
+                              std::pmr::get_default_resource()) noexcept
+        : resource_(resource) {}
+
+    ArenaStorage(const ArenaStorage &) = delete;
+    ArenaStorage &operator=(const ArenaStorage &) = delete;
+
+    ArenaStorage(ArenaStorage &&other) noexcept
+        : resource_(other.resource_),
+          blocks_(std::move(other.blocks_)),
+          free_list_(std::exchange(other.free_list_, nullptr)),
+          cur_(std::exchange(other.cur_, nullptr)),
+          end_(std::exchange(other.end_, nullptr)),
+          next_block_size_(
+              std::exchange(other.next_block_size_, min_block_size)) {
+        other.blocks_.clear();
+    }
+
+    ArenaStorage &operator=(ArenaStorage &&other) noexcept {
+        if (this != &other) {
+            release();
+            resource_ = other.resource_;
+            blocks_ = std::move(other.blocks_);
+            other.blocks_.clear();
+            free_list_ = std::exchange(other.free_list_, nullptr);
+            cur_ = std::exchange(other.cur_, nullptr);
+            end_ = std::exchange(other.end_, nullptr);
+            next_block_size_ =
+                std::exchange(other.next_block_size_, min_block_size);
+        }
+
+        return *this;
+    }
+
+    ~ArenaStorage() { release(); }
+
+    template <class... Args> T *get_obj(Args&&... args) {
+        Slot *slot = take_slot();
+        try {
+            return ::new (static_cast<void *>(slot->obj_))
+                T(std::forward<Args>(args)...);
+        } catch (...) {
+            put_slot(slot);
+            throw;
+        }
+    }
+
+    void free_obj(T *obj) noexcept {
+        obj->~T();
+        put_slot(reinterpret_cast<Slot *>(obj));
+    }
+
+    // While the free list is empty, makes the next n get_obj calls come from
+    // one contiguous run of slots.
+    void reserve(size_t n) {
+        if (static_cast<size_t>(end_ - cur_) >= n)
+            return;
+
+        while (cur_ != end_)
+            put_slot(cur_++);
+
+        add_block(std::max(n, next_block_size_));
     }
 
-    auto move_end() {
-        return std::make_move_iterator(buffer_.end());
+    // Takes a reference to every block of other that this storage lacks, so
+    // objects made by other may be freed through this storage and outlive
+    // other. Shared blocks stay allocated until every storage holding them
+    // is gone, so sharing is refused when the objects to move would fill
+    // less than 1 / max_shared_slots of the slots taken in, and when other
+    // allocates from an unequal resource, which may be gone first. The
+    // caller copies the objects then.
+    bool share(const ArenaStorage &other, size_t objects) {
+        if (!resource_->is_equal(*other.resource_))
+            return false;
+
+        size_t new_slots = 0;
+        for (Block *block : other.blocks_)
+            if (!std::binary_search(blocks_.begin(), blocks_.end(), block))
+                new_slots += block->size_;
+        if (objects * max_shared_slots < new_slots)
+            return false;
+
+        std::vector<Block *> merged;
+        merged.reserve(blocks_.size() + other.blocks_.size());
+
+        auto it = blocks_.begin();
+        for (Block *block : other.blocks_) {
+            for (; it != blocks_.end() && *it < block; ++it)
+                merged.push_back(*it);
+
+            if (it != blocks_.end() && *it == block) {
+                merged.push_back(*it++);
+                continue;
+            }
+
+            block->refs_.fetch_add(1, std::memory_order_relaxed);
+            merged.push_back(block);
+        }
+        merged.insert(merged.end(), it, blocks_.end());
+
+        blocks_ = std::move(merged);
+        return true;
     }
+
+    std::pmr::memory_resource *resource() const noexcept { return resource_; }
+
 private:
-    std::vector<std::unique_ptr<T>> buffer_;
-}; // class Builder
+    static Slot *slots(Block *block) noexcept {
+        return reinterpret_cast<Slot *>(reinterpret_cast<std::byte *>(block) +
+                                        header_size);
+    }
+
+    Slot *take_slot() {
+        if (free_list_ != nullptr)
+            return std::exchange(free_list_, free_list_->next_);
+
+        if (cur_ == end_) {
+            add_block(next_block_size_);
+            next_block_size_ = std::min(next_block_size_ * 2, max_block_size);
+        }
+
+        return cur_++;
+    }
+
+    void put_slot(Slot *slot) noexcept {
+        slot->next_ = free_list_;
+        free_list_ = slot;
+    }
+
+    // Blocks are kept sorted by address so that share can merge lists.
+    void add_block(size_t size) {
+        blocks_.reserve(blocks_.size() + 1);
+        void *raw = resource_->allocate(header_size + size * sizeof(Slot),
+                                        block_align);
+        Block *block = ::new (raw) Block(size, resource_);
+        blocks_.insert(std::upper_bound(blocks_.begin(), blocks_.end(), block),
+                       block);
+        cur_ = slots(block);
+        end_ = cur_ + size;
+    }
+
+    void release() noexcept {
+        for (Block *block : blocks_) {
+            if (block->refs_.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                continue;
+
+            auto resource = block->resource_;
+            size_t bytes = header_size + block->size_ * sizeof(Slot);
+            block->~Block();
+            resource->deallocate(block, bytes, block_align);
+        }
+        blocks_.clear();
+        free_list_ = cur_ = end_ = nullptr;
+        next_block_size_ = min_block_size;
+    }
+
+    std::pmr::memory_resource *resource_;
+    std::vector<Block *> blocks_;
+    Slot *free_list_ = nullptr;
+    Slot *cur_ = nullptr;
+    Slot *end_ = nullptr;
+    size_t next_block_size_ = min_block_size;
+}; // class ArenaStorage
+
+template <typename Compare>
+concept transparent_compare = requires { typename Compare::is_transparent; };
+
+struct Empty final {};
+
+// Map entries keep their key const, so the rest of them may change through
+// an iterator; other keys are read-only, as in std::set.
+template <typename T> struct mutable_entry : std::false_type {};
+
+template <typename K, typename V>
+struct mutable_entry<std::pair<const K, V>> : std::true_type {};
 } // namespace details
 
-template <typename KeyT = int, typename Compare = std::less<KeyT>>
+// A tree aggregate is a monoid over the keys: identity(), lift(key) for one
+// key and an associative combine(lhs, rhs), all static. Nodes update their
+// aggregates while rebalancing, so none of these nor copying a value may
+// throw. Every node keeps the aggregate of its subtree, and
+// AVLtree::aggregate(lo, hi) combines the keys of [lo, hi] in order in
+// O(log n).
+template <typename Aggregate, typename KeyT>
+concept tree_aggregate =
+    std::is_nothrow_copy_constructible_v<typename Aggregate::value_type> &&
+    std::is_nothrow_move_assignable_v<typename Aggregate::value_type> &&
+    requires(const KeyT &key, const typename Aggregate::value_type &value) {
+        { Aggregate::identity() } noexcept -> std::convertible_to<typename Aggregate::value_type>;
+        { Aggregate::lift(key) } noexcept -> std::convertible_to<typename Aggregate::value_type>;
+        { Aggregate::combine(value, value) } noexcept -> std::convertible_to<typename Aggregate::value_type>;
+    };
+
+namespace aggregates {
+// Number of keys. Trees keep subtree sizes anyway, so this one is served by
+// them and costs nothing.
+struct Count final {
+    using value_type = size_t;
+
+    static size_t identity() noexcept { return 0; }
+
+    template <typename KeyT> static size_t lift(const KeyT &) noexcept {
+        return 1;
+    }
+
+    static size_t combine(size_t lhs, size_t rhs) noexcept { return lhs + rhs; }
+};
+
+template <typename T>
+    requires std::is_arithmetic_v<T>
+struct Sum final {
+    using value_type = T;
+
+    static T identity() noexcept { return T{}; }
+
+    static T lift(const T &key) noexcept { return key; }
+
+    static T combine(const T &lhs, const T &rhs) noexcept { return lhs + rhs; }
+};
+
+template <typename T>
+    requires std::is_arithmetic_v<T>
+struct Min final {
+    using value_type = T;
+
+    static T identity() noexcept { return std::numeric_limits<T>::max(); }
+
+    static T lift(const T &key) noexcept { return key; }
+
+    static T combine(const T &lhs, const T &rhs) noexcept {
+        return std::min(lhs, rhs);
+    }
+};
+
+template <typename T>
+    requires std::is_arithmetic_v<T>
+struct Max final {
+    using value_type = T;
+
+    static T identity() noexcept { return std::numeric_limits<T>::lowest(); }
+
+    static T lift(const T &key) noexcept { return key; }
+
+    static T combine(const T &lhs, const T &rhs) noexcept {
+        return std::max(lhs, rhs);
+    }
+};
+} // namespace aggregates
+
+// Counters of the work a tree does, chosen by its last template parameter.
+// The default counts nothing and takes no space.
+namespace stats {
+struct None final {
+    void on_insert() noexcept {}
+    void on_touch() noexcept {}
+    void on_height_update() noexcept {}
+    void on_rotations(size_t) noexcept {}
+};
+
+// Work of inserts: nodes whose counters change, heights recomputed and
+// rotations.
+struct Insert final {
+    void on_insert() noexcept {
+        inserts++;
+        touched_nodes++;
+    }
+
+    void on_touch() noexcept { touched_nodes++; }
+
+    void on_height_update() noexcept { height_updates++; }
+
+    void on_rotations(size_t count) noexcept { rotations += count; }
+
+    size_t inserts = 0;
+    size_t rotations = 0;
+    size_t touched_nodes = 0;
+    size_t height_updates = 0;
+};
+} // namespace stats
+
+template <typename KeyT, typename ValueT, typename Compare,
+          template <typename> class Storage>
+class AVLmap;
+
+template <typename KeyT, typename Compare, template <typename> class Storage>
+class AVLmultiset;
+
+template <typename KeyT = int, typename Compare = std::less<KeyT>,
+          template <typename> class Storage = details::ArenaStorage,
+          tree_aggregate<KeyT> Aggregate = aggregates::Count,
+          typename Stats = stats::None>
 class AVLtree final {
+    static constexpr bool stores_aggregate =
+        !std::is_same_v<Aggregate, aggregates::Count>;
+
+    using AggregateValue =
+        std::conditional_t<stores_aggregate, typename Aggregate::value_type,
+                           details::Empty>;
+
     struct Node final {
         Node() = delete;
-        Node(const KeyT &key) : key_(key) {}
+        Node(const KeyT &key) : key_(key) { init_aggregate(); }
         Node(const KeyT &key, Node *parent, Node *left = nullptr,
              Node *right = nullptr)
-            : key_(key), parent_(parent), left_(left), right_(right) {}
+            : key_(key), parent_(parent), left_(left), right_(right) {
+            init_aggregate();
+        }
 
-        static Node *balance_node(const KeyT &key, Node *node) noexcept {
-            int balance = balance_factor(node);
+        template <typename... Args>
+        Node(std::in_place_t, Node *parent, Args&&... args)
+            : parent_(parent), key_(std::forward<Args>(args)...) {
+            init_aggregate();
+        }
 
-            if (balance > 1 && key < node->left_->key_)
-                return rotate_right(node);
+        static Node *rebalance(Node *node) noexcept {
+            size_t rotations = 0;
+            return rebalance(node, rotations);
+        }
 
-            if (balance < -1 && key > node->right_->key_)
-                return rotate_left(node);
+        static Node *rebalance(Node *node, size_t &rotations) noexcept {
+            int balance = balance_factor(node);
 
-            if (balance > 1 && key > node->left_->key_) {
-                node->left_ = rotate_left(node->left_);
+            if (balance > 1) {
+                if (balance_factor(node->left_) < 0) {
+                    node->left_ = rotate_left(node->left_);
+                    rotations++;
+                }
+                rotations++;
                 return rotate_right(node);
             }
 
-            if (balance < -1 && key < node->right_->key_) {
-                node->right_ = rotate_right(node->right_);
+            if (balance < -1) {
+                if (balance_factor(node->right_) > 0) {
+                    node->right_ = rotate_right(node->right_);
+                    rotations++;
+                }
+                rotations++;
                 return rotate_left(node);
             }
 
             return node;
         }
 
+        bool is_unbalanced() const noexcept {
+            int balance = height(left_) - height(right_);
+            return balance > 1 || balance < -1;
+        }
+
         void update_node() noexcept {
             height_ = 1 + std::max(height(left_), height(right_));
         }
 
-        size_t count_bigger(Node *root) {
-            Node *cur = root;
-            size_t count = 0;
+        void update_counts() noexcept {
+            count_left_childs_ = subtree_size(left_);
+            count_right_childs_ = subtree_size(right_);
+            update_aggregate();
+        }
 
-            while (cur != nullptr) {
-                if (cur->key_ > key_) {
-                    count += cur->count_right_childs_ + 1;
-                    cur = cur->left_;
-                } else if (cur->key_ < key_) {
-                    cur = cur->right_;
-                } else {
-                    return count + cur->count_right_childs_;
-                }
+        void update_aggregate() noexcept {
+            if constexpr (stores_aggregate)
+                aggregate_ = Aggregate::combine(
+                    Aggregate::combine(aggregate_of(left_),
+                                       Aggregate::lift(key_)),
+                    aggregate_of(right_));
+        }
+
+        static AggregateValue aggregate_of(const Node *node) noexcept {
+            if constexpr (stores_aggregate)
+                return node ? node->aggregate_ : Aggregate::identity();
+            else
+                return {};
+        }
+
+        // Turns an unlinked node into a new leaf under parent.
+        void reset(Node *parent) noexcept {
+            left_ = right_ = nullptr;
+            parent_ = parent;
+            height_ = 1;
+            count_left_childs_ = count_right_childs_ = 0;
+            init_aggregate();
+        }
+
+        // Makes left and right the subtrees of mid and restores the AVL
+        // shape in O(|height(left) - height(right)|). Keys of left must be
+        // less than mid's key and keys of right greater. Returns the new root,
+        // which has no parent.
+        static Node *join(Node *left, Node *mid, Node *right) noexcept {
+            Node *root = mid;
+            if (height(left) > height(right) + 1)
+                root = join_right(left, mid, right);
+            else if (height(right) > height(left) + 1)
+                root = join_left(left, mid, right);
+            else
+                attach(mid, left, right);
+
+            root->parent_ = nullptr;
+            return root;
+        }
+
+        // Unlinks the leftmost node of root's subtree into min. Returns the
+        // rebalanced rest, which has no parent.
+        static Node *detach_min(Node *root, Node *&min) noexcept {
+            if (root->left_ == nullptr) {
+                min = root;
+                Node *right = std::exchange(root->right_, nullptr);
+                if (right)
+                    right->parent_ = nullptr;
+                return right;
             }
-            return count;
+
+            Node *left = detach_min(root->left_, min);
+            root->left_ = left;
+            if (left)
+                left->parent_ = root;
+
+            root->update_node();
+            root->update_counts();
+            root = rebalance(root);
+            root->parent_ = nullptr;
+            return root;
         }
 
     private:
-        void update_and_balance(const KeyT &key) {
-            if (left_)
-                left_->update_node();
-            if (right_)
-                right_->update_node();
+        void init_aggregate() noexcept {
+            if constexpr (stores_aggregate)
+                aggregate_ = Aggregate::lift(key_);
+        }
+
+        static void attach(Node *node, Node *left, Node *right) noexcept {
+            node->left_ = left;
+            node->right_ = right;
+            if (left)
+                left->parent_ = node;
+            if (right)
+                right->parent_ = node;
 
-            left_ = balance_node(key, left_);
-            right_ = balance_node(key, right_);
+            node->update_node();
+            node->update_counts();
+        }
+
+        // Walks down the right spine of left to a subtree no more than one
+        // level higher than right and hangs mid there.
+        static Node *join_right(Node *left, Node *mid, Node *right) noexcept {
+            Node *sub = mid;
+            if (height(left->right_) <= height(right) + 1)
+                attach(mid, left->right_, right);
+            else
+                sub = join_right(left->right_, mid, right);
+
+            left->right_ = sub;
+            sub->parent_ = left;
+            left->update_node();
+            left->update_counts();
+            return rebalance(left);
+        }
+
+        static Node *join_left(Node *left, Node *mid, Node *right) noexcept {
+            Node *sub = mid;
+            if (height(right->left_) <= height(left) + 1)
+                attach(mid, left, right->left_);
+            else
+                sub = join_left(left, mid, right->left_);
+
+            right->left_ = sub;
+            sub->parent_ = right;
+            right->update_node();
+            right->update_counts();
+            return rebalance(right);
+        }
+
+        static size_t subtree_size(Node *node) noexcept {
+            return node ? 1U + node->count_left_childs_ +
+                              node->count_right_childs_
+                        : 0U;
         }
 
         static int height(Node *node) noexcept {
@@ -115,6 +597,8 @@ class AVLtree final {
 
             x->update_node();
             y->update_node();
+            x->update_aggregate();
+            y->update_aggregate();
 
             if (T2)
                 T2->parent_ = x;
@@ -148,22 +632,24 @@ class AVLtree final {
         KeyT key_;
         size_t count_left_childs_ = 0;
         size_t count_right_childs_ = 0;
+        [[no_unique_address]] AggregateValue aggregate_;
     }; // class Node
 
     class Iterator final {
     public:
-        using iterator_category = std::bidirectional_iterator_tag;
+        using iterator_category = std::random_access_iterator_tag;
         using value_type = KeyT;
-        using difference_type = size_t;
-        using pointer = value_type*;
-        using reference = value_type&;
+        using difference_type = std::ptrdiff_t;
+        using reference = std::conditional_t<details::mutable_entry<KeyT>::value,
+                                             KeyT &, const KeyT &>;
+        using pointer = std::add_pointer_t<reference>;
 
         Iterator() = default;
-        Iterator(Node *node, const AVLtree<KeyT, Compare> &tree)
-            : node_(node), tree_(tree) {}
+        Iterator(Node *node, const AVLtree &tree)
+            : node_(node), tree_(&tree) {}
 
         Iterator &operator++() noexcept {
-            if (node_ == nullptr || node_ == tree_.back_) {
+            if (node_ == nullptr || node_ == tree_->back_) {
                 node_ = nullptr;
                 return *this;
             }
@@ -186,13 +672,18 @@ class AVLtree final {
         }
 
         Iterator &operator--() noexcept {
-            if (node_ == tree_.front_) {
+            if (node_ == nullptr) {
+                node_ = tree_->back_;
+                return *this;
+            }
+
+            if (node_ == tree_->front_) {
                 node_ = nullptr;
                 return *this;
             }
 
             if (node_->left_) {
-                node_ = find_max(node_->right_);
+                node_ = find_max(node_->left_);
                 return *this;
             }
 
@@ -208,52 +699,77 @@ class AVLtree final {
             return *this;
         }
 
-        Iterator &operator++(int) noexcept {
+        Iterator operator++(int) noexcept {
             Iterator it(*this);
             ++(*this);
             return it;
         }
 
-        Iterator &operator--(int) noexcept {
+        Iterator operator--(int) noexcept {
             Iterator it(*this);
             --(*this);
             return it;
         }
 
-        KeyT operator*() const {
-            if (node_ == nullptr)
-                throw std::out_of_range("Iterator is at post-end");
+        Iterator &operator+=(difference_type n) noexcept {
+            if (n != 0)
+                node_ = tree_->select_node(tree_->node_index(node_) + n);
+            return *this;
+        }
 
-            return node_->key_;
+        Iterator &operator-=(difference_type n) noexcept {
+            return *this += -n;
         }
 
-        KeyT &operator*() {
-            if (node_ == nullptr)
-                throw std::out_of_range("Iterator is at post-end");
+        friend Iterator operator+(Iterator it, difference_type n) noexcept {
+            return it += n;
+        }
 
-            return node_->key_;
+        friend Iterator operator+(difference_type n, Iterator it) noexcept {
+            return it += n;
         }
 
-        KeyT const *operator->() const {
+        friend Iterator operator-(Iterator it, difference_type n) noexcept {
+            return it -= n;
+        }
+
+        friend difference_type operator-(const Iterator &lhs,
+                                         const Iterator &rhs) noexcept {
+            return lhs.index() - rhs.index();
+        }
+
+        reference operator*() const {
             if (node_ == nullptr)
                 throw std::out_of_range("Iterator is at post-end");
 
-            return &(node_->key_);
+            return node_->key_;
         }
 
-        KeyT *operator->() {
+        pointer operator->() const {
             if (node_ == nullptr)
                 throw std::out_of_range("Iterator is at post-end");
 
             return &(node_->key_);
         }
 
+        reference operator[](difference_type n) const { return *(*this + n); }
+
         friend bool operator==(const Iterator &lhs,
                                const Iterator &rhs) noexcept {
-            return lhs.node_ == rhs.node_ && &lhs.tree_ == &rhs.tree_;
+            return lhs.node_ == rhs.node_ && lhs.tree_ == rhs.tree_;
+        }
+
+        // Iterators of one tree are ordered by the position of their keys.
+        friend std::strong_ordering operator<=>(const Iterator &lhs,
+                                                const Iterator &rhs) noexcept {
+            return lhs.index() <=> rhs.index();
         }
 
     private:
+        difference_type index() const noexcept {
+            return static_cast<difference_type>(tree_->node_index(node_));
+        }
+
         Node *find_min(Node *node) const noexcept {
             while (node && node->left_)
                 node = node->left_;
@@ -267,24 +783,121 @@ class AVLtree final {
         }
 
         Node *node_ = nullptr;
-        const AVLtree<KeyT, Compare> &tree_;
+        const AVLtree *tree_ = nullptr;
+
+        friend class AVLtree;
     }; // class Iterator;
 
 public:
+    // Owns a node taken out by extract, whose key can be changed before it
+    // goes back into a tree. The handle refers to the storage of the tree it
+    // came from, so it has to be inserted or dropped while that tree lives.
+    class NodeHandle final {
+    public:
+        NodeHandle() = default;
+
+        NodeHandle(NodeHandle &&other) noexcept
+            : node_(std::exchange(other.node_, nullptr)),
+              storage_(other.storage_) {}
+
+        NodeHandle &operator=(NodeHandle &&other) noexcept {
+            if (this != &other) {
+                reset();
+                node_ = std::exchange(other.node_, nullptr);
+                storage_ = other.storage_;
+            }
+
+            return *this;
+        }
+
+        ~NodeHandle() { reset(); }
+
+        bool empty() const noexcept { return node_ == nullptr; }
+
+        explicit operator bool() const noexcept { return node_ != nullptr; }
+
+        KeyT &key() const noexcept { return node_->key_; }
+
+    private:
+        NodeHandle(Node *node, Storage<Node> *storage) noexcept
+            : node_(node), storage_(storage) {}
+
+        void reset() noexcept {
+            if (node_ != nullptr)
+                storage_->free_obj(std::exchange(node_, nullptr));
+        }
+
+        Node *node_ = nullptr;
+        Storage<Node> *storage_ = nullptr;
+
+        friend class AVLtree;
+    }; // class NodeHandle
+
+    // Result of inserting a node handle: when the key was already there, the
+    // handle is given back in node.
+    struct InsertReturn final {
+        Iterator position;
+        bool inserted;
+        NodeHandle node;
+    };
+
+    using key_type = KeyT;
+    using value_type = KeyT;
+    using size_type = size_t;
+    using key_compare = Compare;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+    using node_type = NodeHandle;
+    using insert_return_type = InsertReturn;
+
     AVLtree() = default;
+
+    explicit AVLtree(std::pmr::memory_resource *resource)
+        : storage_(resource) {}
+
+    explicit AVLtree(const Compare &comp,
+                     std::pmr::memory_resource *resource =
+                         std::pmr::get_default_resource())
+        : comp_(comp), storage_(resource) {}
+
     AVLtree(const KeyT &key) {
-        details::Builder<Node> builder;
-        root_ = builder.get_obj(key, nullptr);
-        std::move(builder.move_begin(), builder.move_end(), std::back_inserter(buffer_));
+        root_ = front_ = back_ = storage_.get_obj(key, nullptr);
+    }
+
+    AVLtree(KeyT &&key) {
+        root_ = front_ = back_ =
+            storage_.get_obj(std::in_place, nullptr, std::move(key));
     }
 
-    AVLtree(const AVLtree<KeyT, Compare> &other) {
+    template <std::input_iterator InputIt>
+    AVLtree(InputIt first, InputIt last,
+            std::pmr::memory_resource *resource =
+                std::pmr::get_default_resource())
+        : AVLtree(Compare{}, resource) {
+        build_from(first, last);
+    }
+
+    template <std::input_iterator InputIt>
+    AVLtree(InputIt first, InputIt last, const Compare &comp,
+            std::pmr::memory_resource *resource =
+                std::pmr::get_default_resource())
+        : AVLtree(comp, resource) {
+        build_from(first, last);
+    }
+
+    AVLtree(const AVLtree &other)
+        : AVLtree(other, std::pmr::get_default_resource()) {}
+
+    // Nodes are linked as soon as they are created, so if a key copy throws,
+    // the destructor of the delegated-to object frees the partial copy.
+    AVLtree(const AVLtree &other, std::pmr::memory_resource *resource)
+        : AVLtree(other.comp_, resource) {
         if (other.root_ == nullptr) {
             return;
         }
 
-        details::Builder<Node> builder;
-        root_ = builder.get_obj(other.root_->key_);
+        storage_.reserve(other.size());
+        root_ = storage_.get_obj(other.root_->key_);
         root_->height_ = other.root_->height_;
 
         std::stack<std::pair<Node*, Node*>> stack;
@@ -294,133 +907,714 @@ public:
             auto [original, copy] = stack.top();
             copy->count_left_childs_ = original->count_left_childs_;
             copy->count_right_childs_ = original->count_right_childs_;
+            copy->aggregate_ = original->aggregate_;
             stack.pop();
 
             if (original->left_) {
-                copy->left_ = builder.get_obj(original->left_->key_);
+                copy->left_ = storage_.get_obj(original->left_->key_);
                 copy->left_->parent_ = copy;
                 copy->left_->height_ = original->left_->height_;
                 stack.push({original->left_, copy->left_});
             }
 
             if (original->right_) {
-                copy->right_ = builder.get_obj(original->right_->key_);
+                copy->right_ = storage_.get_obj(original->right_->key_);
                 copy->right_->parent_ = copy;
                 copy->right_->height_ = original->right_->height_;
                 stack.push({original->right_, copy->right_});
             }
         }
-        
-        auto newIterBegin = builder.move_begin();
-        auto newIterEnd = builder.move_end();
-        buffer_.reserve(std::distance(newIterBegin, newIterEnd));
 
-        std::move(newIterBegin, newIterEnd, std::back_inserter(buffer_));
+        update_front_back();
     }
 
-    AVLtree<KeyT, Compare> &operator=(const AVLtree<KeyT, Compare> &other) {
+    AVLtree &operator=(const AVLtree &other) {
         if (this != &other) {
             auto tmp{other};
-            std::swap(*this, tmp);
+            swap(tmp);
+        }
+
+        return *this;
+    }
+
+    AVLtree(AVLtree &&other) noexcept
+        : comp_(std::move(other.comp_)),
+          root_(std::exchange(other.root_, nullptr)),
+          front_(std::exchange(other.front_, nullptr)),
+          back_(std::exchange(other.back_, nullptr)),
+          storage_(std::move(other.storage_)) {}
+
+    AVLtree &operator=(AVLtree &&other) noexcept {
+        if (this != &other) {
+            destroy_nodes();
+            comp_ = std::move(other.comp_);
+            root_ = std::exchange(other.root_, nullptr);
+            front_ = std::exchange(other.front_, nullptr);
+            back_ = std::exchange(other.back_, nullptr);
+            storage_ = std::move(other.storage_);
         }
 
         return *this;
     }
 
-    AVLtree(AVLtree<KeyT, Compare> &&other) noexcept = default;
-    AVLtree<KeyT, Compare> &
-    operator=(AVLtree<KeyT, Compare> &&other) noexcept = default;
-    ~AVLtree() = default;
+    ~AVLtree() { destroy_nodes(); }
+
+    // Replaces the content with the keys of [first, last). A strictly sorted
+    // random access range is built in O(n); other ranges are sorted first.
+    template <std::input_iterator InputIt>
+    void assign(InputIt first, InputIt last) {
+        *this = AVLtree(first, last, comp_, storage_.resource());
+    }
+
+    void swap(AVLtree &other) noexcept {
+        std::swap(comp_, other.comp_);
+        std::swap(root_, other.root_);
+        std::swap(front_, other.front_);
+        std::swap(back_, other.back_);
+        std::swap(storage_, other.storage_);
+    }
+
+    size_t size() const noexcept {
+        return root_ ? 1U + root_->count_left_childs_ +
+                           root_->count_right_childs_
+                     : 0U;
+    }
+
+    bool empty() const noexcept { return root_ == nullptr; }
+
+    int height() const noexcept { return root_ ? root_->height_ : 0; }
+
+    Compare key_comp() const { return comp_; }
+
+    const Stats &stats() const noexcept { return stats_; }
 
     std::pair<Iterator, bool> insert(const KeyT &key) {
-        auto [place, parent] = find(key);
+        return try_emplace_node(key, key);
+    }
+
+    std::pair<Iterator, bool> insert(KeyT &&key) {
+        return try_emplace_node(key, std::move(key));
+    }
+
+    // Constructs the key from args inside the new node. If an equivalent key
+    // is already there, the new one is destroyed.
+    template <typename... Args>
+    std::pair<Iterator, bool> emplace(Args&&... args) {
+        return emplace_node(std::forward<Args>(args)...);
+    }
+
+    // Puts the node of handle back without copying its key. A node from
+    // another tree is adopted when this storage already shares its memory
+    // (after split, for one) and has its key moved into a new node
+    // otherwise, so that one node does not keep the other tree's memory
+    // allocated.
+    InsertReturn insert(NodeHandle &&handle) {
+        if (handle.empty())
+            return {end(), false, NodeHandle{}};
 
+        auto [place, parent] = find_place(handle.key());
         if (!place)
-            return {Iterator{parent, *this}, false};
+            return {Iterator{parent, *this}, false, std::move(handle)};
+
+        Node *node = nullptr;
+        if (handle.storage_ == &storage_ ||
+            storage_.share(*handle.storage_, 1)) {
+            node = std::exchange(handle.node_, nullptr);
+            node->reset(parent);
+        } else {
+            node = storage_.get_obj(std::in_place, parent,
+                                    std::move(handle.key()));
+            handle.reset();
+        }
 
-        details::Builder<Node> builder;
-        *place = builder.get_obj(key, parent);
-        auto current = *place;
+        link_leaf(place, node);
+        return {Iterator{node, *this}, true, NodeHandle{}};
+    }
 
-        while (parent) {
-            if (parent->left_ == current)
-                parent->count_left_childs_++;
-            else if (parent->right_ == current)
-                parent->count_right_childs_++;
+    // Unlinks the node at pos and hands it over without destroying the key.
+    // Iterators to other keys stay valid.
+    NodeHandle extract(Iterator pos) noexcept {
+        unlink_node(pos.node_);
+        return NodeHandle{pos.node_, &storage_};
+    }
 
-            if (current->left_)
-                current->left_->update_node();
-            if (current->right_)
-                current->right_->update_node();
+    NodeHandle extract(const KeyT &key) { return extract_key(key); }
 
-            current->left_ = Node::balance_node(key, current->left_);
-            current->right_ = Node::balance_node(key, current->right_);
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    NodeHandle extract(const K &key) {
+        return extract_key(key);
+    }
 
-            current = parent;
-            parent = parent->parent_;
-        }
+    Iterator erase(Iterator pos) noexcept {
+        Iterator next = pos;
+        ++next;
+        erase_node(pos.node_);
+        return next;
+    }
 
-        update_front_back();
+    Iterator erase(Iterator first, Iterator last) noexcept {
+        while (first != last)
+            first = erase(first);
+        return last;
+    }
 
-        auto newIterBegin = builder.move_begin();
-        auto newIterEnd = builder.move_end();
-        buffer_.reserve(buffer_.size() + std::distance(newIterBegin, newIterEnd));
-        std::move(newIterBegin, newIterEnd, std::back_inserter(buffer_));
-        
-        return {Iterator{*place, *this}, true};
+    size_t erase(const KeyT &key) { return erase_key(key); }
+
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    size_t erase(const K &key) {
+        return erase_key(key);
     }
 
     Iterator lower_bound(const KeyT &key) const {
-        Iterator it = begin();
+        return Iterator{lower_bound_node(key), *this};
+    }
 
-        if (back_ != nullptr)
-            if (key > back_->key_)
-                return Iterator{nullptr, this};
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    Iterator lower_bound(const K &key) const {
+        return Iterator{lower_bound_node(key), *this};
+    }
 
-        while (it.node_ != nullptr && it.node_->key_ < key)
-            ++it;
+    Iterator upper_bound(const KeyT &key) const {
+        return Iterator{upper_bound_node(key), *this};
+    }
 
-        return it;
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    Iterator upper_bound(const K &key) const {
+        return Iterator{upper_bound_node(key), *this};
     }
 
-    Iterator upper_bound(const KeyT &key) const {
-        Iterator it = back();
+    Iterator find(const KeyT &key) const {
+        return Iterator{find_node(key), *this};
+    }
 
-        if (front_ != nullptr)
-            if (key < front_->key_)
-                return Iterator{nullptr, this};
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    Iterator find(const K &key) const {
+        return Iterator{find_node(key), *this};
+    }
 
-        while (it.node_ != nullptr && it.node_->key_ > key)
-            --it;
+    bool contains(const KeyT &key) const { return find_node(key) != nullptr; }
 
-        return it;
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    bool contains(const K &key) const {
+        return find_node(key) != nullptr;
     }
 
-    size_t get_num_elems_from_diapason(const KeyT &key1, const KeyT &key2) const {
-        if (key1 > key2 || root_ == nullptr)
-            return 0;
+    std::pair<Iterator, Iterator> equal_range(const KeyT &key) const {
+        return equal_range_impl(key);
+    }
 
-        Node *node1 = lower_bound_node(key1);
-        Node *node2 = upper_bound_node(key2);
-        if (node1 == nullptr || node2 == nullptr)
-            return 0;
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    std::pair<Iterator, Iterator> equal_range(const K &key) const {
+        return equal_range_impl(key);
+    }
+
+    // Number of keys that are less than key.
+    size_t rank(const KeyT &key) const { return count_less(key); }
+
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    size_t rank(const K &key) const {
+        return count_less(key);
+    }
+
+    // The k-th smallest key, counting from zero.
+    const KeyT &select(size_t k) const {
+        Node *node = select_node(k);
+        if (node == nullptr)
+            throw std::out_of_range("Index is out of tree size");
+
+        return node->key_;
+    }
+
+    Iterator nth(size_t k) const { return Iterator{select_node(k), *this}; }
+
+    size_t get_num_elems_from_diapason(const KeyT &key1,
+                                       const KeyT &key2) const {
+        return count_diapason(key1, key2);
+    }
+
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    size_t get_num_elems_from_diapason(const K &key1, const K &key2) const {
+        return count_diapason(key1, key2);
+    }
+
+    // Combines the keys of [lo, hi] in key order.
+    typename Aggregate::value_type aggregate(const KeyT &lo,
+                                             const KeyT &hi) const {
+        return aggregate_impl(lo, hi);
+    }
+
+    template <typename K>
+        requires details::transparent_compare<Compare>
+    typename Aggregate::value_type aggregate(const K &lo, const K &hi) const {
+        return aggregate_impl(lo, hi);
+    }
+
+    // Answers a batch of [key1, key2] counts. The endpoints are sorted and
+    // ranked in one sweep that restarts each descent from the deepest node
+    // whose subtree still contains the next endpoint.
+    std::vector<size_t>
+    count_ranges(std::span<const std::pair<KeyT, KeyT>> ranges) const {
+        struct Endpoint {
+            const KeyT *key;
+            bool inclusive;
+            size_t index;
+        };
+
+        std::vector<size_t> answers(ranges.size(), 0);
+        std::vector<Endpoint> endpoints;
+        endpoints.reserve(2 * ranges.size());
+
+        for (size_t i = 0; i < ranges.size(); i++) {
+            auto &[key1, key2] = ranges[i];
+            if (comp_(key2, key1))
+                continue;
+
+            endpoints.push_back({&key1, false, i});
+            endpoints.push_back({&key2, true, i});
+        }
+
+        std::sort(endpoints.begin(), endpoints.end(),
+                  [this](const Endpoint &lhs, const Endpoint &rhs) {
+                      if (comp_(*lhs.key, *rhs.key))
+                          return true;
+                      if (comp_(*rhs.key, *lhs.key))
+                          return false;
+                      return !lhs.inclusive && rhs.inclusive;
+                  });
+
+        RankSweep sweep{*this};
+        for (auto &endpoint : endpoints) {
+            size_t rank = sweep.next(*endpoint.key, endpoint.inclusive);
+            if (endpoint.inclusive)
+                answers[endpoint.index] += rank;
+            else
+                answers[endpoint.index] -= rank;
+        }
+
+        return answers;
+    }
+
+    // Builds a tree of the keys of left, key and the keys of right. Every
+    // key of left must be less than key and every key of right greater.
+    // Nodes are moved, not copied, so this takes O(log n), unless right holds
+    // few keys for its memory (see merge).
+    static AVLtree join(AVLtree left, const KeyT &key, AVLtree right) {
+        if ((!left.empty() && !left.comp_(left.back_->key_, key)) ||
+            (!right.empty() && !left.comp_(key, right.front_->key_)))
+            throw std::invalid_argument("Keys to join are out of order");
+
+        if (!left.storage_.share(right.storage_, right.size())) {
+            left.insert(key);
+            left.merge(right);
+            return left;
+        }
+
+        Node *mid = left.storage_.get_obj(key, nullptr);
+        Node *right_root = right.release_nodes();
+        left.set_root(Node::join(left.root_, mid, right_root));
+        return left;
+    }
+
+    // Moves the keys that are not less than key into the returned tree in
+    // O(log n); a part that is small for the memory of this tree is copied
+    // instead, so it does not keep all of it allocated. Iterators to the
+    // moved keys are invalidated.
+    AVLtree split(const KeyT &key) {
+        AVLtree result{comp_, storage_.resource()};
+        if (!result.storage_.share(storage_, size() - rank(key))) {
+            move_keys(result, lower_bound(key), end());
+            return result;
+        }
+
+        auto [less, equal, greater] = split_nodes(release_nodes(), key);
+        if (equal)
+            greater = Node::join(nullptr, equal, greater);
+
+        set_root(less);
+        result.set_root(greater);
+        return result;
+    }
+
+    // Moves the keys of [lo, hi] into the returned tree in O(log n), or
+    // copies them when they are few, as split does.
+    AVLtree extract_range(const KeyT &lo, const KeyT &hi) {
+        AVLtree result{comp_, storage_.resource()};
+        if (empty() || comp_(hi, lo))
+            return result;
+
+        if (!result.storage_.share(storage_, count_diapason(lo, hi))) {
+            move_keys(result, lower_bound(lo), upper_bound(hi));
+            return result;
+        }
+
+        auto [less, low, rest] = split_nodes(release_nodes(), lo);
+        auto [middle, high, greater] = split_nodes(rest, hi);
+        if (low)
+            middle = Node::join(nullptr, low, middle);
+        if (high)
+            middle = Node::join(middle, high, nullptr);
+
+        set_root(join_nodes(less, greater));
+        result.set_root(middle);
+        return result;
+    }
+
+    // Moves all keys of other into this tree, leaving other empty; a key
+    // found in both is kept once. Trees whose key ranges do not overlap are
+    // joined in O(log n), others are united in O(m log(n / m + 1)) for sizes
+    // m <= n. Nodes are copied when the storages cannot share them: over
+    // unequal resources, or when other holds few keys for its memory. They
+    // are copied one by one, and if that throws every key is still in one
+    // of the trees.
+    void merge(AVLtree &other) {
+        if (this == &other || other.empty())
+            return;
+
+        if (!storage_.share(other.storage_, other.size())) {
+            while (!other.empty())
+                other.move_node(*this, other.begin());
+            return;
+        }
+
+        if (empty()) {
+            set_root(other.release_nodes());
+            return;
+        }
 
-        size_t count1 = node1->count_bigger(root_);
-        size_t count2 = node2->count_bigger(root_);
+        bool before = comp_(back_->key_, other.front_->key_);
+        bool after = comp_(other.back_->key_, front_->key_);
+        Node *mine = release_nodes();
+        Node *theirs = other.release_nodes();
+
+        if (before)
+            set_root(join_nodes(mine, theirs));
+        else if (after)
+            set_root(join_nodes(theirs, mine));
+        else
+            set_root(union_nodes(mine, theirs));
+    }
 
-        assert(count1 + 2U > count2);
-        return 1U + count1 - count2;
+    // Moves the keys of other that lie in [lo, hi] into this tree.
+    void splice(AVLtree &other, const KeyT &lo, const KeyT &hi) {
+        AVLtree moved = other.extract_range(lo, hi);
+        merge(moved);
     }
 
-    KeyT front() const { return front_->key_; }
+    void clear() noexcept { destroy_nodes(); }
 
-    KeyT back() const { return back_->key_; }
+    const KeyT &front() const { return front_->key_; }
+
+    const KeyT &back() const { return back_->key_; }
 
     Iterator begin() const { return Iterator{front_, *this}; }
 
     Iterator end() const { return Iterator{nullptr, *this}; }
 
 private:
+    // Moves the keys of [first, last) into result one by one, for storages
+    // that cannot share nodes.
+    void move_keys(AVLtree &result, Iterator first, Iterator last) {
+        while (first != last)
+            move_node(result, first++);
+    }
+
+    // Moves the key at pos into a node of to. If that throws, the node goes
+    // back into this tree, so neither tree loses a key or keeps a moved-from
+    // one.
+    void move_node(AVLtree &to, Iterator pos) {
+        auto node = extract(pos);
+        try {
+            to.insert(std::move(node));
+        } catch (...) {
+            insert(std::move(node));
+            throw;
+        }
+    }
+
+    void destroy_nodes() noexcept {
+        if constexpr (Storage<Node>::frees_in_bulk &&
+                      std::is_trivially_destructible_v<Node>) {
+            root_ = front_ = back_ = nullptr;
+            return;
+        }
+
+        Node *cur = std::exchange(root_, nullptr);
+        front_ = back_ = nullptr;
+
+        while (cur != nullptr) {
+            if (cur->left_) {
+                cur = std::exchange(cur->left_, nullptr);
+            } else if (cur->right_) {
+                cur = std::exchange(cur->right_, nullptr);
+            } else {
+                Node *parent = cur->parent_;
+                storage_.free_obj(cur);
+                cur = parent;
+            }
+        }
+    }
+
+    Node *release_nodes() noexcept {
+        front_ = back_ = nullptr;
+        return std::exchange(root_, nullptr);
+    }
+
+    void set_root(Node *root) noexcept {
+        root_ = root;
+        if (root_ == nullptr) {
+            front_ = back_ = nullptr;
+            return;
+        }
+
+        root_->parent_ = nullptr;
+        update_front_back();
+    }
+
+    static Node *detach_child(Node *&child) noexcept {
+        Node *node = std::exchange(child, nullptr);
+        if (node)
+            node->parent_ = nullptr;
+        return node;
+    }
+
+    // Splits a parentless subtree into the keys less than key, the node
+    // equal to key (if any) and the keys greater than key.
+    template <typename K>
+    std::tuple<Node *, Node *, Node *> split_nodes(Node *root, const K &key) {
+        if (root == nullptr)
+            return {nullptr, nullptr, nullptr};
+
+        Node *left = detach_child(root->left_);
+        Node *right = detach_child(root->right_);
+
+        if (comp_(key, root->key_)) {
+            auto [less, equal, greater] = split_nodes(left, key);
+            return {less, equal, Node::join(greater, root, right)};
+        }
+
+        if (comp_(root->key_, key)) {
+            auto [less, equal, greater] = split_nodes(right, key);
+            return {Node::join(left, root, less), equal, greater};
+        }
+
+        root->parent_ = nullptr;
+        return {left, root, right};
+    }
+
+    // Joins two parentless subtrees whose keys are all ordered left before
+    // right.
+    static Node *join_nodes(Node *left, Node *right) noexcept {
+        if (left == nullptr)
+            return right;
+        if (right == nullptr)
+            return left;
+
+        Node *min = nullptr;
+        Node *rest = Node::detach_min(right, min);
+        return Node::join(left, min, rest);
+    }
+
+    // Unites two parentless subtrees; the nodes of theirs whose keys are in
+    // mine are freed.
+    Node *union_nodes(Node *mine, Node *theirs) {
+        if (mine == nullptr)
+            return theirs;
+        if (theirs == nullptr)
+            return mine;
+
+        Node *left = detach_child(mine->left_);
+        Node *right = detach_child(mine->right_);
+        auto [less, equal, greater] = split_nodes(theirs, mine->key_);
+        if (equal)
+            storage_.free_obj(equal);
+
+        Node *united_left = union_nodes(left, less);
+        Node *united_right = union_nodes(right, greater);
+        return Node::join(united_left, mine, united_right);
+    }
+
+    template <typename InputIt>
+    void build_from(InputIt first, InputIt last) {
+        if constexpr (std::random_access_iterator<InputIt>) {
+            auto not_ascending = [this](const KeyT &lhs, const KeyT &rhs) {
+                return !comp_(lhs, rhs);
+            };
+
+            if (std::adjacent_find(first, last, not_ascending) == last) {
+                build_balanced(first, static_cast<size_t>(last - first));
+                return;
+            }
+        }
+
+        std::vector<KeyT> keys(first, last);
+        std::sort(keys.begin(), keys.end(), comp_);
+        auto equal = [this](const KeyT &lhs, const KeyT &rhs) {
+            return !comp_(lhs, rhs) && !comp_(rhs, lhs);
+        };
+        keys.erase(std::unique(keys.begin(), keys.end(), equal), keys.end());
+
+        build_balanced(std::make_move_iterator(keys.begin()), keys.size());
+    }
+
+    template <typename RandomIt> void build_balanced(RandomIt first, size_t n) {
+        if (n == 0)
+            return;
+
+        storage_.reserve(n);
+        build_subtree(first, n, nullptr, &root_);
+        update_front_back();
+    }
+
+    // Nodes are created in preorder and linked right away, so the arena gets
+    // one contiguous run and a throwing key copy leaves a destroyable tree.
+    // Keys are moved when first is a move iterator.
+    template <typename RandomIt>
+    void build_subtree(RandomIt first, size_t n, Node *parent, Node **link) {
+        if (n == 0)
+            return;
+
+        size_t mid = n / 2;
+        Node *node = *link =
+            storage_.get_obj(std::in_place, parent, first[mid]);
+        node->height_ = std::bit_width(n);
+        node->count_left_childs_ = mid;
+        node->count_right_childs_ = n - mid - 1;
+
+        build_subtree(first, mid, node, &node->left_);
+        build_subtree(first + mid + 1, n - mid - 1, node, &node->right_);
+        node->update_aggregate();
+    }
+
+    Node **child_link(Node *node) noexcept {
+        Node *parent = node->parent_;
+        if (parent == nullptr)
+            return &root_;
+
+        return parent->left_ == node ? &parent->left_ : &parent->right_;
+    }
+
+    // Restores heights, counters and AVL balance from node up to the root.
+    void rebalance_up(Node *node) noexcept {
+        while (node != nullptr) {
+            Node *parent = node->parent_;
+            Node **link = child_link(node);
+
+            node->update_node();
+            node->update_counts();
+            *link = Node::rebalance(node);
+
+            node = parent;
+        }
+    }
+
+    void erase_node(Node *node) noexcept {
+        unlink_node(node);
+        storage_.free_obj(node);
+    }
+
+    // A node with two children is replaced by its in-order successor, which
+    // is relinked rather than copied, so iterators to other keys stay valid.
+    void unlink_node(Node *node) noexcept {
+        Node *start = nullptr;
+
+        if (node->left_ && node->right_) {
+            Node *next = node->right_;
+            while (next->left_ != nullptr)
+                next = next->left_;
+
+            if (next->parent_ != node) {
+                start = next->parent_;
+                start->left_ = next->right_;
+                if (next->right_)
+                    next->right_->parent_ = start;
+
+                next->right_ = node->right_;
+                next->right_->parent_ = next;
+            } else {
+                start = next;
+            }
+
+            next->left_ = node->left_;
+            next->left_->parent_ = next;
+            *child_link(node) = next;
+            next->parent_ = node->parent_;
+        } else {
+            Node *child = node->left_ ? node->left_ : node->right_;
+            if (child)
+                child->parent_ = node->parent_;
+
+            *child_link(node) = child;
+            start = node->parent_;
+        }
+
+        bool is_edge = node == front_ || node == back_;
+        rebalance_up(start);
+
+        if (root_ == nullptr)
+            front_ = back_ = nullptr;
+        else if (is_edge)
+            update_front_back();
+    }
+
+    // Subtree counters and aggregates change on the whole path. Heights stop
+    // changing at the first ancestor that keeps its height or needs a
+    // rotation, because the rotation brings the subtree back to its height
+    // before the insert.
+    void fix_after_insert(Node *node) noexcept {
+        bool growing = true;
+        size_t rotations = 0;
+
+        stats_.on_insert();
+
+        for (Node *cur = node->parent_; cur != nullptr;
+             node = cur, cur = cur->parent_) {
+            if (cur->left_ == node)
+                cur->count_left_childs_++;
+            else
+                cur->count_right_childs_++;
+            cur->update_aggregate();
+            stats_.on_touch();
+
+            if (!growing)
+                continue;
+            stats_.on_height_update();
+
+            int height = cur->height_;
+            cur->update_node();
+
+            if (cur->is_unbalanced()) {
+                Node **link = child_link(cur);
+                cur = *link = Node::rebalance(cur, rotations);
+                growing = false;
+            } else if (cur->height_ == height) {
+                growing = false;
+            }
+        }
+
+        stats_.on_rotations(rotations);
+    }
+
+    void update_front_back(Node *inserted) noexcept {
+        Node *parent = inserted->parent_;
+
+        if (parent == nullptr) {
+            front_ = back_ = inserted;
+        } else if (parent == front_ && parent->left_ == inserted) {
+            front_ = inserted;
+        } else if (parent == back_ && parent->right_ == inserted) {
+            back_ = inserted;
+        }
+    }
+
     void update_front_back() {
         Node *front = root_, *back = root_;
 
@@ -435,63 +1629,340 @@ private:
         back_ = back;
     }
     
-    Node* lower_bound_node(const KeyT &key) const {
-        return bound_node(key, std::less<KeyT>{}, true);
+    Node *select_node(size_t k) const noexcept {
+        Node *cur = root_;
+
+        while (cur != nullptr) {
+            if (k < cur->count_left_childs_) {
+                cur = cur->left_;
+            } else if (k == cur->count_left_childs_) {
+                return cur;
+            } else {
+                k -= cur->count_left_childs_ + 1;
+                cur = cur->right_;
+            }
+        }
+        return nullptr;
     }
-    
-    Node* upper_bound_node(const KeyT &key) const {
-        return bound_node(key, std::greater<KeyT>{}, false);
+
+    // Position of node in the in-order sequence; end() maps to size().
+    size_t node_index(const Node *node) const noexcept {
+        if (node == nullptr)
+            return size();
+
+        size_t index = node->count_left_childs_;
+        for (; node->parent_ != nullptr; node = node->parent_) {
+            if (node == node->parent_->right_)
+                index += node->parent_->count_left_childs_ + 1;
+        }
+        return index;
     }
 
-    template <typename CompT>
-    Node* bound_node(const KeyT &key, CompT comp, bool is_lower) const {
-        Node* cur = root_;
-        Node* ans = root_;
-    
+    template <typename K> Node *lower_bound_node(const K &key) const {
+        Node *cur = root_;
+        Node *ans = nullptr;
+
         while (cur != nullptr) {
-            if (comp(key, cur->key_)) {
+            if (comp_(cur->key_, key)) {
+                cur = cur->right_;
+            } else {
                 ans = cur;
-                cur = is_lower ? cur->left_ : cur->right_;
-            } else if (cur->key_ == key) {
-                return cur;
+                cur = cur->left_;
+            }
+        }
+
+        return ans;
+    }
+
+    template <typename K> Node *upper_bound_node(const K &key) const {
+        Node *cur = root_;
+        Node *ans = nullptr;
+
+        while (cur != nullptr) {
+            if (comp_(key, cur->key_)) {
+                ans = cur;
+                cur = cur->left_;
             } else {
-                cur = is_lower ? cur->right_ : cur->left_;
+                cur = cur->right_;
             }
         }
-    
-        if (is_lower && ans->key_ < key) {
-            return nullptr;
-        } else if (!is_lower && ans->key_ > key) {
+
+        return ans;
+    }
+
+    template <typename K> Node *find_node(const K &key) const {
+        Node *node = lower_bound_node(key);
+        if (node == nullptr || comp_(key, node->key_))
             return nullptr;
+
+        return node;
+    }
+
+    template <typename K>
+    std::pair<Iterator, Iterator> equal_range_impl(const K &key) const {
+        Iterator first{lower_bound_node(key), *this};
+        if (first.node_ == nullptr || comp_(key, first.node_->key_))
+            return {first, first};
+
+        Iterator last = first;
+        return {first, ++last};
+    }
+
+    template <typename K> NodeHandle extract_key(const K &key) {
+        Node *node = find_node(key);
+        if (node == nullptr)
+            return NodeHandle{};
+
+        return extract(Iterator{node, *this});
+    }
+
+    template <typename K> size_t erase_key(const K &key) {
+        Node *node = find_node(key);
+        if (node == nullptr)
+            return 0;
+
+        erase_node(node);
+        return 1;
+    }
+
+    template <typename K>
+    typename Aggregate::value_type aggregate_impl(const K &lo,
+                                                  const K &hi) const {
+        if constexpr (!stores_aggregate) {
+            return count_diapason(lo, hi);
+        } else {
+            if (comp_(hi, lo))
+                return Aggregate::identity();
+
+            // The highest node inside [lo, hi] splits the range into a part
+            // of its left subtree and a part of its right one.
+            Node *top = root_;
+            while (top != nullptr &&
+                   (comp_(top->key_, lo) || comp_(hi, top->key_)))
+                top = comp_(top->key_, lo) ? top->right_ : top->left_;
+
+            if (top == nullptr)
+                return Aggregate::identity();
+
+            auto left = Aggregate::identity();
+            for (Node *cur = top->left_; cur != nullptr;) {
+                if (comp_(cur->key_, lo)) {
+                    cur = cur->right_;
+                } else {
+                    left = Aggregate::combine(
+                        Aggregate::combine(Aggregate::lift(cur->key_),
+                                           Node::aggregate_of(cur->right_)),
+                        left);
+                    cur = cur->left_;
+                }
+            }
+
+            auto right = Aggregate::identity();
+            for (Node *cur = top->right_; cur != nullptr;) {
+                if (comp_(hi, cur->key_)) {
+                    cur = cur->left_;
+                } else {
+                    right = Aggregate::combine(
+                        right,
+                        Aggregate::combine(Node::aggregate_of(cur->left_),
+                                           Aggregate::lift(cur->key_)));
+                    cur = cur->right_;
+                }
+            }
+
+            return Aggregate::combine(
+                Aggregate::combine(left, Aggregate::lift(top->key_)), right);
         }
-    
-        return ans;
     }
 
-    std::pair<Node**, Node*> find(const KeyT &key) noexcept {
+    template <typename K> size_t count_less(const K &key) const {
+        Node *cur = root_;
+        size_t count = 0;
+
+        while (cur != nullptr) {
+            if (comp_(cur->key_, key)) {
+                count += cur->count_left_childs_ + 1;
+                cur = cur->right_;
+            } else {
+                cur = cur->left_;
+            }
+        }
+        return count;
+    }
+
+    // One descent: the path is shared until the highest node inside
+    // [key1, key2], then the two bounds are finished in its subtrees. A bound
+    // that is not in the tree just ends its walk at a leaf.
+    template <typename K>
+    size_t count_diapason(const K &key1, const K &key2) const {
+        if (comp_(key2, key1))
+            return 0;
+
+        Node *top = root_;
+        while (top != nullptr) {
+            if (comp_(top->key_, key1))
+                top = top->right_;
+            else if (comp_(key2, top->key_))
+                top = top->left_;
+            else
+                break;
+        }
+
+        if (top == nullptr)
+            return 0;
+
+        size_t count = 1;
+        for (Node *cur = top->left_; cur != nullptr;) {
+            if (comp_(cur->key_, key1)) {
+                cur = cur->right_;
+            } else {
+                count += cur->count_right_childs_ + 1;
+                cur = cur->left_;
+            }
+        }
+
+        for (Node *cur = top->right_; cur != nullptr;) {
+            if (comp_(key2, cur->key_)) {
+                cur = cur->left_;
+            } else {
+                count += cur->count_left_childs_ + 1;
+                cur = cur->right_;
+            }
+        }
+        return count;
+    }
+
+    // Counts keys before a boundary for boundaries given in ascending order.
+    // Each frame is a subtree on the current path, the number of keys before
+    // it and its fence: the nearest ancestor that bounds it from the right.
+    class RankSweep final {
+        struct Frame {
+            Node *node;
+            size_t offset;
+            Node *fence;
+        };
+
+    public:
+        explicit RankSweep(const AVLtree &tree) : tree_(tree) {
+            path_.reserve(tree.height() + 1);
+            if (tree.root_ != nullptr)
+                path_.push_back({tree.root_, 0, nullptr});
+        }
+
+        size_t next(const KeyT &key, bool inclusive) {
+            if (path_.empty())
+                return 0;
+
+            while (path_.size() > 1 && path_.back().fence != nullptr &&
+                   goes_right(path_.back().fence, key, inclusive))
+                path_.pop_back();
+
+            Frame cur = path_.back();
+            while (true) {
+                Frame child;
+                if (goes_right(cur.node, key, inclusive)) {
+                    child = {cur.node->right_,
+                             cur.offset + cur.node->count_left_childs_ + 1,
+                             cur.fence};
+                } else {
+                    child = {cur.node->left_, cur.offset, cur.node};
+                }
+
+                if (child.node == nullptr)
+                    return child.offset;
+
+                path_.push_back(child);
+                cur = child;
+            }
+        }
+
+    private:
+        bool goes_right(Node *node, const KeyT &key, bool inclusive) const {
+            return inclusive ? !tree_.comp_(key, node->key_)
+                             : tree_.comp_(node->key_, key);
+        }
+
+        const AVLtree &tree_;
+        std::vector<Frame> path_;
+    }; // class RankSweep
+
+    // Constructs a node from args only when no key equivalent to key is in
+    // the tree.
+    template <typename K, typename... Args>
+    std::pair<Iterator, bool> try_emplace_node(const K &key, Args&&... args) {
+        auto [place, parent] = find_place(key);
+        if (!place)
+            return {Iterator{parent, *this}, false};
+
+        Node *node = storage_.get_obj(std::in_place, parent,
+                                      std::forward<Args>(args)...);
+        link_leaf(place, node);
+        return {Iterator{node, *this}, true};
+    }
+
+    // Constructs the node first and looks for its place by its own key, so
+    // a key that is already there costs one construction.
+    template <typename... Args>
+    std::pair<Iterator, bool> emplace_node(Args&&... args) {
+        Node *node = storage_.get_obj(std::in_place, nullptr,
+                                      std::forward<Args>(args)...);
+        auto [place, parent] = find_place(node->key_);
+        if (!place) {
+            storage_.free_obj(node);
+            return {Iterator{parent, *this}, false};
+        }
+
+        node->parent_ = parent;
+        link_leaf(place, node);
+        return {Iterator{node, *this}, true};
+    }
+
+    // Lets modify change the key at pos in a way that keeps its place in the
+    // order, and refreshes the aggregates above it.
+    template <typename ModifyT>
+    void modify_in_place(Iterator pos, ModifyT &&modify) {
+        modify(pos.node_->key_);
+        for (Node *cur = pos.node_; cur != nullptr; cur = cur->parent_)
+            cur->update_aggregate();
+    }
+
+    void link_leaf(Node **place, Node *node) noexcept {
+        *place = node;
+        update_front_back(node);
+        fix_after_insert(node);
+    }
+
+    template <typename K>
+    std::pair<Node**, Node*> find_place(const K &key) noexcept {
         Node *parent = nullptr;
         Node **place = &root_;
 
         while (*place) {
-            if (key == (*place)->key_)
-                return {nullptr, *place};
-
-            if (key < (*place)->key_) {
+            if (comp_(key, (*place)->key_)) {
                 parent = *place;
                 place = &parent->left_;
-            } else {
+            } else if (comp_((*place)->key_, key)) {
                 parent = *place;
                 place = &parent->right_;
+            } else {
+                return {nullptr, *place};
             }
         }
 
         return {place, parent};
     }
 
+    [[no_unique_address]] Compare comp_;
     Node *root_ = nullptr;
     Node *front_ = nullptr;
     Node *back_ = nullptr;
-    std::vector<std::unique_ptr<Node>> buffer_;
+    Storage<Node> storage_;
+
+    template <typename, typename, typename, template <typename> class>
+    friend class AVLmap;
+    template <typename, typename, template <typename> class>
+    friend class AVLmultiset;
+    [[no_unique_address]] Stats stats_;
 }; // class AVL tree
 
 } // namespace trees
\ No newline at end of file
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory_resource>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "input_file.hpp"
+#include "tree.hpp"
+
+namespace trees {
+
+class snapshot_error final : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+namespace details {
+
+inline constexpr char snapshot_magic[8] = {'A', 'V', 'L', 'S',
+                                           'N', 'A', 'P', '\0'};
+inline constexpr std::uint32_t snapshot_version = 1;
+inline constexpr std::uint32_t snapshot_byte_order = 0x01020304;
+inline constexpr std::uint32_t snapshot_nil =
+    std::numeric_limits<std::uint32_t>::max();
+
+// The nodes follow the header directly.
+struct SnapshotHeader final {
+    char magic_[8];
+    std::uint32_t version_;
+    std::uint32_t byte_order_;
+    std::uint32_t key_size_;
+    std::uint32_t node_size_;
+    std::uint64_t count_;
+    std::uint64_t root_;
+    std::uint64_t checksum_;
+    std::uint64_t reserved_[2];
+};
+static_assert(sizeof(SnapshotHeader) == 64);
+
+// Nodes are stored in key order, so the index of a node is its rank.
+// Children are referred to by index, which keeps the file independent of
+// where it is mapped.
+template <typename KeyT> struct SnapshotNode final {
+    KeyT key_;
+    std::uint32_t left_;
+    std::uint32_t right_;
+};
+
+// FNV-1a over 64-bit words with a rotation after each step, so that every
+// bit of a word reaches the low bits of the hash.
+inline std::uint64_t snapshot_checksum(const void *data, size_t size) noexcept {
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+
+    auto mix = [&hash](std::uint64_t word) {
+        hash = std::rotl((hash ^ word) * 0x100000001b3ULL, 29);
+    };
+
+    size_t i = 0;
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        mix(word);
+    }
+
+    if (i < size) {
+        std::uint64_t word = 0;
+        std::memcpy(&word, bytes + i, size - i);
+        mix(word);
+    }
+    return hash;
+}
+
+// Links nodes[first, first + n) into the shape AVLtree builds from sorted
+// keys and returns the index of the subtree root.
+template <typename KeyT>
+std::uint32_t link_snapshot(std::vector<SnapshotNode<KeyT>> &nodes,
+                            size_t first, size_t n) {
+    if (n == 0)
+        return snapshot_nil;
+
+    size_t mid = first + n / 2;
+    nodes[mid].left_ = link_snapshot(nodes, first, n / 2);
+    nodes[mid].right_ = link_snapshot(nodes, mid + 1, n - n / 2 - 1);
+    return static_cast<std::uint32_t>(mid);
+}
+
+} // namespace details
+
+// Writes the keys of tree to path as a snapshot: a versioned header with a
+// checksum and a flat array of nodes. The file is written next to path and
+// renamed over it, so a crash never leaves a half-written snapshot.
+template <typename KeyT, typename Compare, template <typename> class Storage,
+          tree_aggregate<KeyT> Aggregate, typename Stats>
+    requires std::is_trivially_copyable_v<KeyT>
+void save(const AVLtree<KeyT, Compare, Storage, Aggregate, Stats> &tree,
+          const std::filesystem::path &path) {
+    using Node = details::SnapshotNode<KeyT>;
+
+    if (tree.size() >= details::snapshot_nil)
+        throw std::length_error("Tree is too large for a snapshot");
+
+    // Value-initialized, so the padding bytes that go into the checksum
+    // are zero.
+    std::vector<Node> nodes(tree.size());
+    auto node = nodes.begin();
+    for (auto &key : tree)
+        (node++)->key_ = key;
+
+    details::SnapshotHeader header{};
+    std::memcpy(header.magic_, details::snapshot_magic, sizeof(header.magic_));
+    header.version_ = details::snapshot_version;
+    header.byte_order_ = details::snapshot_byte_order;
+    header.key_size_ = sizeof(KeyT);
+    header.node_size_ = sizeof(Node);
+    header.count_ = nodes.size();
+    header.root_ = details::link_snapshot(nodes, 0, nodes.size());
+    header.checksum_ =
+        details::snapshot_checksum(nodes.data(), nodes.size() * sizeof(Node));
+
+    std::filesystem::path temp = path;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(nodes.data()),
+                  static_cast<std::streamsize>(nodes.size() * sizeof(Node)));
+        out.close();
+        if (!out)
+            throw snapshot_error("Cannot write snapshot " + temp.string());
+    }
+    std::filesystem::rename(temp, path);
+}
+
+// Read-only tree over a snapshot file. Queries descend through the mapped
+// pages, so opening costs a header check and, unless it is skipped, one
+// pass for the checksum. Without the checksum the file is trusted: a
+// damaged one may send a query out of bounds.
+template <typename KeyT = int, typename Compare = std::less<KeyT>>
+    requires std::is_trivially_copyable_v<KeyT>
+class MappedAVLtree final {
+    using Node = details::SnapshotNode<KeyT>;
+
+public:
+    using key_type = KeyT;
+    using value_type = KeyT;
+    using size_type = size_t;
+    using key_compare = Compare;
+
+    explicit MappedAVLtree(const std::filesystem::path &path,
+                           bool verify_checksum = true,
+                           const Compare &comp = Compare{})
+        : comp_(comp), file_(path.c_str(), query::Access::random) {
+        auto data = file_.view();
+        details::SnapshotHeader header;
+        if (data.size() < sizeof(header))
+            fail(path, "is too short");
+        std::memcpy(&header, data.data(), sizeof(header));
+
+        if (std::memcmp(header.magic_, details::snapshot_magic,
+                        sizeof(header.magic_)) != 0)
+            fail(path, "is not a snapshot");
+        if (header.version_ != details::snapshot_version)
+            fail(path, "has unsupported version " +
+                           std::to_string(header.version_));
+        if (header.byte_order_ != details::snapshot_byte_order)
+            fail(path, "has a different byte order");
+        if (header.key_size_ != sizeof(KeyT) ||
+            header.node_size_ != sizeof(Node))
+            fail(path, "holds keys of another type");
+        if (header.count_ >= details::snapshot_nil ||
+            data.size() != sizeof(header) + header.count_ * sizeof(Node))
+            fail(path, "has a wrong size");
+        if (header.count_ == 0 ? header.root_ != details::snapshot_nil
+                               : header.root_ >= header.count_)
+            fail(path, "has a wrong root");
+
+        const char *first = data.data() + sizeof(header);
+        if (verify_checksum &&
+            details::snapshot_checksum(first, data.size() - sizeof(header)) !=
+                header.checksum_)
+            fail(path, "is damaged: checksum mismatch");
+
+        nodes_ = {reinterpret_cast<const Node *>(first),
+                  static_cast<size_t>(header.count_)};
+        root_ = static_cast<std::uint32_t>(header.root_);
+    }
+
+    MappedAVLtree(const MappedAVLtree &) = delete;
+    MappedAVLtree &operator=(const MappedAVLtree &) = delete;
+
+    size_t size() const noexcept { return nodes_.size(); }
+
+    bool empty() const noexcept { return nodes_.empty(); }
+
+    Compare key_comp() const { return comp_; }
+
+    bool contains(const KeyT &key) const {
+        size_t index = count_less(key);
+        return index < nodes_.size() && !comp_(key, nodes_[index].key_);
+    }
+
+    // Number of keys that are less than key.
+    size_t rank(const KeyT &key) const { return count_less(key); }
+
+    // The k-th smallest key, counting from zero.
+    const KeyT &select(size_t k) const {
+        if (k >= nodes_.size())
+            throw std::out_of_range("Index is out of tree size");
+
+        return nodes_[k].key_;
+    }
+
+    size_t get_num_elems_from_diapason(const KeyT &key1,
+                                       const KeyT &key2) const {
+        if (comp_(key2, key1))
+            return 0;
+
+        return count_not_greater(key2) - count_less(key1);
+    }
+
+    // The keys in order, straight from the mapped pages.
+    auto keys() const {
+        return nodes_ | std::views::transform(
+                            [](const Node &node) -> const KeyT & {
+                                return node.key_;
+                            });
+    }
+
+private:
+    [[noreturn]] static void fail(const std::filesystem::path &path,
+                                  const std::string &what) {
+        throw snapshot_error("Snapshot " + path.string() + " " + what);
+    }
+
+    // A node's index is its rank, so the last node where the descent turns
+    // left bounds the answer.
+    size_t count_less(const KeyT &key) const {
+        size_t count = nodes_.size();
+        for (std::uint32_t cur = root_; cur != details::snapshot_nil;) {
+            if (comp_(nodes_[cur].key_, key)) {
+                cur = nodes_[cur].right_;
+            } else {
+                count = cur;
+                cur = nodes_[cur].left_;
+            }
+        }
+        return count;
+    }
+
+    size_t count_not_greater(const KeyT &key) const {
+        size_t count = nodes_.size();
+        for (std::uint32_t cur = root_; cur != details::snapshot_nil;) {
+            if (comp_(key, nodes_[cur].key_)) {
+                count = cur;
+                cur = nodes_[cur].left_;
+            } else {
+                cur = nodes_[cur].right_;
+            }
+        }
+        return count;
+    }
+
+    [[no_unique_address]] Compare comp_;
+    query::InputFile file_;
+    std::span<const Node> nodes_;
+    std::uint32_t root_ = details::snapshot_nil;
+}; // class MappedAVLtree
+
+// Reads a snapshot into a new tree. The keys are already sorted, so the
+// tree is built in O(n) without comparisons beyond one order check.
+template <typename KeyT, typename Compare = std::less<KeyT>>
+    requires std::is_trivially_copyable_v<KeyT>
+AVLtree<KeyT, Compare> load(const std::filesystem::path &path,
+                            std::pmr::memory_resource *resource =
+                                std::pmr::get_default_resource()) {
+    MappedAVLtree<KeyT, Compare> snapshot{path};
+    auto keys = snapshot.keys();
+    return AVLtree<KeyT, Compare>{keys.begin(), keys.end(), snapshot.key_comp(),
+                                  resource};
+}
+
+} // namespace trees
@@ -1,28 +1,43 @@
 #include <cassert>
+#include <fstream>
 #include <iostream>
+#include <string_view>
 #include <vector>
 
+#include "fast_input.hpp"
+#include "fast_output.hpp"
+#include "multiset.hpp"
 #include "process_queries.hpp"
+#include "stream_queries.hpp"
 #include "tree.hpp"
 
-int main() {
-    std::vector<query::Query<int>> queries;
-    bool result = query::process_input<int>(queries, std::cin);
-    if (!result) {
-        std::cout << "Incorrect input" << std::endl;
-        return 1;
-    }
+namespace {
+struct Options final {
+    const char *path = nullptr;
+    bool stream = false;
+    bool multiset = false;
+    query::OutputFormat format = query::OutputFormat::text;
+};
 
+query::AnswerWriter make_writer(const Options &options) {
+#ifdef QUERY_HAS_WRITE
+    return query::AnswerWriter{STDOUT_FILENO, options.format};
+#else
+    return query::AnswerWriter{std::cout, options.format};
+#endif
+}
+} // namespace
+
+template <typename TreeT, typename Iter>
+int run_queries(Iter begin, Iter end, const Options &options) {
     try {
-        trees::AVLtree<int> tree;
-        auto distance = [](trees::AVLtree<int> &tree, int key1, int key2) {
-            return tree.get_num_elems_from_diapason(key1, key2);
-        };
+        TreeT tree;
 
-        std::vector<size_t> answer_tree = query::get_answers<int>(
-            tree, queries.begin(), queries.end(), distance);
+        std::vector<size_t> answer_tree =
+            query::get_answers<int>(tree, begin, end, query::RangeCount{});
 
-        query::print_answers(answer_tree);
+        query::AnswerWriter writer = make_writer(options);
+        query::print_answers(answer_tree, writer);
     } catch (std::out_of_range &out_of_range_ex) {
         std::cout << "Out of Range error: " << std::endl
                   << out_of_range_ex.what() << std::endl;
@@ -37,4 +52,86 @@ int main() {
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+template <typename TreeT> int run_stream(const Options &options) {
+    try {
+        TreeT tree;
+        query::AnswerWriter writer = make_writer(options);
+
+        if (options.path == nullptr) {
+#ifdef QUERY_HAS_POSIX
+            query::process_stream<int>(tree, query::FdReader{STDIN_FILENO},
+                                       writer, query::RangeCount{});
+#else
+            query::process_stream<int>(tree, query::StreamReader{std::cin},
+                                       writer, query::RangeCount{});
+#endif
+            return 0;
+        }
+
+        std::ifstream in(options.path, std::ios::binary);
+        if (!in) {
+            std::cout << "Cannot read input: " << options.path << std::endl;
+            return 1;
+        }
+        query::process_stream<int>(tree, query::StreamReader{in}, writer,
+                                   query::RangeCount{});
+    } catch (query::parse_error &parse_ex) {
+        std::cout << "Incorrect input: " << parse_ex.what() << std::endl;
+        return 1;
+    } catch (std::exception &ex) {
+        std::cout << "Exception: " << std::endl << ex.what() << std::endl;
+    }
+
+    return 0;
+}
+
+template <typename Iter> int run(Iter begin, Iter end, const Options &options) {
+    if (options.multiset)
+        return run_queries<trees::AVLmultiset<int>>(begin, end, options);
+    return run_queries<trees::AVLtree<int>>(begin, end, options);
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg{argv[i]};
+        if (arg == "--stream")
+            options.stream = true;
+        else if (arg == "--binary")
+            options.format = query::OutputFormat::binary;
+        else if (arg == "--multiset")
+            options.multiset = true;
+        else
+            options.path = argv[i];
+    }
+
+    if (options.stream)
+        return options.multiset ? run_stream<trees::AVLmultiset<int>>(options)
+                                : run_stream<trees::AVLtree<int>>(options);
+
+    if (options.path != nullptr) {
+        query::CommandBuffer<int> commands;
+        try {
+            commands = query::parse_file<int>(options.path);
+        } catch (query::parse_error &parse_ex) {
+            std::cout << "Incorrect input: " << parse_ex.what() << std::endl;
+            return 1;
+        } catch (std::exception &ex) {
+            std::cout << "Cannot read input: " << ex.what() << std::endl;
+            return 1;
+        }
+
+        return run(commands.begin(), commands.end(), options);
+    }
+
+    std::vector<query::Query<int>> queries;
+    bool result = query::process_input<int>(queries, std::cin);
+    if (!result) {
+        std::cout << "Incorrect input" << std::endl;
+        return 1;
+    }
+
+    return run(queries.begin(), queries.end(), options);
+}
@@ -5,7 +5,7 @@ from sys import executable
 
 num_test = 1
 is_ok = True
-for i in range(1, 11):
+for i in range(1, 16):
     str_data =  "tests/end_to_end/" + str(i) + ".dat"
     file_in = open(str_data, "r")
     str_ans = "tests/end_to_end/" + str(i) + ".dat.ans"
@@ -15,19 +15,23 @@ for i in range(1, 11):
         ans.append(int(i.strip()))
 	
     result = run(["build/src/main"], capture_output = True, encoding='cp866', stdin=file_in)
+    result_file = run(["build/src/main", str_data], capture_output = True, encoding='cp866')
+    result_stream = run(["build/src/main", "--stream", str_data], capture_output = True, encoding='cp866')
     print("Test: " + str(num_test).strip())
 
     res = list(map(int, result.stdout.split()))
+    res_file = list(map(int, result_file.stdout.split()))
+    res_stream = list(map(int, result_stream.stdout.split()))
 
-    is_ok &= (res == ans)
-    if res == ans:
+    is_ok &= (res == ans) and (res_file == ans) and (res_stream == ans)
+    if res == ans and res_file == ans and res_stream == ans:
         print("OK")
     else:
-        print("ERROR\nExpect:", ans, "\nGive:  ", res)
+        print("ERROR\nExpect:", ans, "\nGive:  ", res, "\nGive from file:  ", res_file, "\nGive from stream:  ", res_stream)
     print("-------------------------------------------------")
     num_test += 1
 
 if is_ok:
 	print("TESTS PASSED")
 else:
-	print("TESTS FAILED")
\ No newline at end of file
+	print("TESTS FAILED")
@@ -1,6 +1,6 @@
 import random
 
-for num_test in range(1, 11):
+def generate(name, with_erase):
     keys = []
     requests1 = []
     requests2 = []
@@ -17,10 +17,18 @@ for num_test in range(1, 11):
         requests1.append(random.randint(0, max_key - 2))
         requests2.append(random.randint(requests1[-1], max_key))
 
-    file = open(str(num_test) + ".dat", "w")
+    file = open(name, "w")
     for i in range(num_keys):
         file.write("k " + str(keys[i]) + "\n")
+        if with_erase and random.random() < 0.4:
+            file.write("d " + str(random.choice(keys[:i + 1])) + "\n")
         for j in range(3):
             file.write("q " + str(requests1[i + j]) + " " + str(requests2[i + j]) + "\n")
     file.write("\n")
-    file.close()
\ No newline at end of file
+    file.close()
+
+for num_test in range(1, 11):
+    generate(str(num_test) + ".dat", False)
+
+for num_test in range(11, 16):
+    generate(str(num_test) + ".dat", True)
@@ -1,6 +1,36 @@
 #include "tree.hpp"
+#include "compact_tree.hpp"
+#include "concurrent_tree.hpp"
+#include "map.hpp"
+#include "multiset.hpp"
+#include "packed_tree.hpp"
+#include "persistent_tree.hpp"
+#include "parallel_queries.hpp"
+#include "fast_input.hpp"
+#include "frozen_index.hpp"
+#include "process_queries.hpp"
+#include "stream_queries.hpp"
+#include "tree_file.hpp"
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <compare>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
 
 TEST(TREE_TESTS, ctor1) {
     trees::AVLtree<int> tree{1};
@@ -305,4 +335,1656 @@ TEST(TREE_TESTS, exception_test) {
     }
     
     ASSERT_EQ(catched, true);
-}
\ No newline at end of file
+}
+
+TEST(TREE_TESTS, heap_storage) {
+    trees::AVLtree<int, std::less<int>, trees::details::HeapStorage> tree;
+    for (int i = 0; i < 1000; i++)
+        tree.insert(i);
+
+    ASSERT_EQ(tree.size(), 1000);
+    ASSERT_EQ(tree.get_num_elems_from_diapason(100, 199), 100);
+
+    auto copy{tree};
+    ASSERT_EQ(copy.get_num_elems_from_diapason(0, 999), 1000);
+}
+
+struct CountingResource : std::pmr::memory_resource {
+    size_t allocations = 0;
+    size_t bytes_in_use = 0;
+
+private:
+    void *do_allocate(size_t bytes, size_t align) override {
+        allocations++;
+        bytes_in_use += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, align);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t align) override {
+        bytes_in_use -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override {
+        return this == &other;
+    }
+};
+
+TEST(TREE_TESTS, arena_storage_resource) {
+    CountingResource resource;
+    {
+        trees::AVLtree<std::string> tree{&resource};
+        for (int i = 0; i < 10000; i++)
+            tree.insert(std::to_string(i));
+
+        ASSERT_EQ(tree.size(), 10000);
+        ASSERT_LT(resource.allocations, 20);
+
+        auto copy = trees::AVLtree<std::string>{tree, &resource};
+        ASSERT_EQ(copy.size(), 10000);
+        ASSERT_EQ(*copy.begin(), "0");
+    }
+    ASSERT_EQ(resource.bytes_in_use, 0);
+}
+
+TEST(TREE_TESTS, bounds) {
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < 100; i += 2)
+        tree.insert(i);
+
+    ASSERT_EQ(*tree.lower_bound(10), 10);
+    ASSERT_EQ(*tree.lower_bound(11), 12);
+    ASSERT_EQ(*tree.upper_bound(10), 12);
+    ASSERT_EQ(*tree.upper_bound(11), 12);
+    ASSERT_EQ(*tree.lower_bound(-5), 0);
+    ASSERT_EQ(tree.lower_bound(99), tree.end());
+    ASSERT_EQ(tree.upper_bound(98), tree.end());
+    ASSERT_EQ(std::distance(tree.lower_bound(10), tree.upper_bound(20)), 6);
+
+    trees::AVLtree<int> empty;
+    ASSERT_EQ(empty.lower_bound(1), empty.end());
+    ASSERT_EQ(empty.upper_bound(1), empty.end());
+}
+
+TEST(TREE_TESTS, find_contains_equal_range) {
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < 100; i += 2)
+        tree.insert(i);
+
+    ASSERT_EQ(*tree.find(42), 42);
+    ASSERT_EQ(tree.find(43), tree.end());
+    ASSERT_TRUE(tree.contains(0));
+    ASSERT_FALSE(tree.contains(101));
+
+    auto [first, last] = tree.equal_range(42);
+    ASSERT_EQ(std::distance(first, last), 1);
+    ASSERT_EQ(*first, 42);
+
+    auto [first2, last2] = tree.equal_range(43);
+    ASSERT_EQ(first2, last2);
+    ASSERT_EQ(*first2, 44);
+}
+
+TEST(TREE_TESTS, reverse_iterator) {
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < 1000; i++)
+        tree.insert((i * 7) % 1000);
+
+    int i = 999;
+    auto it = tree.end();
+    do {
+        --it;
+        ASSERT_EQ(*it, i);
+        i--;
+    } while (it != tree.begin());
+    ASSERT_EQ(i, -1);
+}
+
+TEST(TREE_TESTS, select_rank) {
+    trees::AVLtree<int> tree;
+    std::set<int> set;
+    for (int i = 0; i < 2000; i++) {
+        int key = (i * 7919) % 3001;
+        tree.insert(key);
+        set.insert(key);
+    }
+
+    size_t index = 0;
+    for (auto key : set) {
+        ASSERT_EQ(tree.select(index), key);
+        ASSERT_EQ(tree.rank(key), index);
+        ASSERT_EQ(*tree.nth(index), key);
+        index++;
+    }
+
+    ASSERT_EQ(tree.rank(-1), 0);
+    ASSERT_EQ(tree.rank(5000), set.size());
+    ASSERT_EQ(tree.nth(set.size()), tree.end());
+    ASSERT_THROW(tree.select(set.size()), std::out_of_range);
+}
+
+TEST(TREE_TESTS, iterator_random_access) {
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < 1000; i++)
+        tree.insert(i);
+
+    auto it = tree.begin();
+    it += 500;
+    ASSERT_EQ(*it, 500);
+    it -= 250;
+    ASSERT_EQ(*it, 250);
+    ASSERT_EQ(*(it + 749), 999);
+    ASSERT_EQ(it + 750, tree.end());
+    ASSERT_EQ(*(tree.end() - 1), 999);
+    ASSERT_EQ(tree.end() - tree.begin(), 1000);
+    ASSERT_EQ(tree.upper_bound(300) - tree.lower_bound(100), 201);
+    ASSERT_EQ(std::distance(tree.lower_bound(100), tree.upper_bound(300)), 201);
+    ASSERT_EQ(std::ranges::next(tree.begin(), 10)[5], 15);
+    ASSERT_TRUE(tree.begin() + 3 < tree.end());
+    ASSERT_EQ(*std::ranges::lower_bound(tree, 640), 640);
+
+    static_assert(
+        std::random_access_iterator<trees::AVLtree<int>::iterator>);
+    static_assert(std::random_access_iterator<
+                  trees::AVLmap<int, std::string>::iterator>);
+}
+
+TEST(TREE_TESTS, erase_key) {
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < 100; i++)
+        tree.insert(i);
+
+    ASSERT_EQ(tree.erase(50), 1);
+    ASSERT_EQ(tree.erase(50), 0);
+    ASSERT_EQ(tree.erase(0), 1);
+    ASSERT_EQ(tree.erase(99), 1);
+    ASSERT_EQ(tree.size(), 97);
+    ASSERT_EQ(*tree.begin(), 1);
+    ASSERT_EQ(*(--tree.end()), 98);
+    ASSERT_EQ(tree.get_num_elems_from_diapason(40, 60), 20);
+    ASSERT_FALSE(tree.contains(50));
+}
+
+TEST(TREE_TESTS, erase_iterators) {
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < 100; i++)
+        tree.insert(i);
+
+    auto it = tree.erase(tree.find(10));
+    ASSERT_EQ(*it, 11);
+
+    it = tree.erase(tree.lower_bound(20), tree.lower_bound(30));
+    ASSERT_EQ(*it, 30);
+    ASSERT_EQ(tree.size(), 89);
+    ASSERT_EQ(tree.get_num_elems_from_diapason(0, 29), 19);
+
+    tree.erase(tree.begin(), tree.end());
+    ASSERT_TRUE(tree.empty());
+    ASSERT_EQ(tree.begin(), tree.end());
+
+    tree.insert(5);
+    ASSERT_EQ(*tree.begin(), 5);
+}
+
+TEST(TREE_TESTS, erase_random) {
+    trees::AVLtree<int> tree;
+    std::set<int> set;
+    unsigned state = 12345;
+    auto next = [&state] {
+        state = state * 1103515245U + 12345U;
+        return static_cast<int>((state >> 16) % 2000);
+    };
+
+    for (int i = 0; i < 20000; i++) {
+        int key = next();
+        if (i % 3 == 0) {
+            ASSERT_EQ(tree.erase(key), set.erase(key));
+        } else {
+            tree.insert(key);
+            set.insert(key);
+        }
+
+        if (i % 1000 == 0) {
+            ASSERT_TRUE(std::equal(tree.begin(), tree.end(), set.begin(),
+                                   set.end()));
+            for (size_t k = 0; k < set.size(); k += 37)
+                ASSERT_EQ(tree.rank(tree.select(k)), k);
+        }
+    }
+
+    ASSERT_EQ(tree.size(), set.size());
+    ASSERT_LE(tree.height(), 1.45 * std::log2(tree.size() + 2));
+    ASSERT_EQ(tree.get_num_elems_from_diapason(100, 1500),
+              std::distance(set.lower_bound(100), set.upper_bound(1500)));
+}
+
+TEST(TREE_TESTS, erase_reuses_nodes) {
+    CountingResource resource;
+    trees::AVLtree<int> tree{&resource};
+    for (int i = 0; i < 1000; i++)
+        tree.insert(i);
+
+    size_t allocations = resource.allocations;
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 1000; i += 2)
+            tree.erase(i);
+        for (int i = 0; i < 1000; i += 2)
+            tree.insert(i);
+    }
+
+    ASSERT_EQ(resource.allocations, allocations);
+    ASSERT_EQ(tree.size(), 1000);
+}
+
+TEST(TREE_TESTS, bulk_build_sorted) {
+    std::vector<int> keys(1000);
+    for (int i = 0; i < 1000; i++)
+        keys[i] = i * 3;
+
+    trees::AVLtree<int> tree(keys.begin(), keys.end());
+    ASSERT_EQ(tree.size(), 1000);
+    ASSERT_EQ(tree.height(), 10);
+    ASSERT_TRUE(std::equal(tree.begin(), tree.end(), keys.begin(), keys.end()));
+    ASSERT_EQ(tree.get_num_elems_from_diapason(30, 60), 11);
+    for (size_t k = 0; k < keys.size(); k++)
+        ASSERT_EQ(tree.select(k), keys[k]);
+
+    tree.insert(1);
+    tree.erase(0);
+    ASSERT_EQ(*tree.begin(), 1);
+    ASSERT_EQ(tree.size(), 1000);
+}
+
+TEST(TREE_TESTS, bulk_build_unsorted) {
+    std::set<int> set;
+    std::vector<int> keys;
+    for (int i = 0; i < 5000; i++) {
+        keys.push_back((i * 7919) % 1013);
+        set.insert(keys.back());
+    }
+
+    trees::AVLtree<int> tree(keys.begin(), keys.end());
+    ASSERT_EQ(tree.size(), set.size());
+    ASSERT_TRUE(std::equal(tree.begin(), tree.end(), set.begin(), set.end()));
+
+    std::istringstream in("5 3 9 1");
+    tree.assign(std::istream_iterator<int>(in), std::istream_iterator<int>());
+    ASSERT_EQ(tree.size(), 4);
+    ASSERT_EQ(*tree.begin(), 1);
+    ASSERT_EQ(*(--tree.end()), 9);
+
+    std::vector<int> empty;
+    tree.assign(empty.begin(), empty.end());
+    ASSERT_TRUE(tree.empty());
+}
+
+TEST(TREE_TESTS, compact_tree_random) {
+    trees::CompactAVLtree<int> tree;
+    std::set<int> set;
+    unsigned state = 777;
+    auto next = [&state] {
+        state = state * 1103515245U + 12345U;
+        return static_cast<int>((state >> 16) % 3000);
+    };
+
+    for (int i = 0; i < 20000; i++) {
+        int key = next();
+        if (i % 3 == 0)
+            ASSERT_EQ(tree.erase(key), set.erase(key));
+        else
+            ASSERT_EQ(tree.insert(key), set.insert(key).second);
+    }
+
+    ASSERT_EQ(tree.size(), set.size());
+    ASSERT_TRUE(std::equal(tree.begin(), tree.end(), set.begin(), set.end()));
+    ASSERT_LE(tree.height(), 1.45 * std::log2(tree.size() + 2));
+
+    for (int key = -10; key < 3010; key += 17) {
+        ASSERT_EQ(tree.rank(key), std::distance(set.begin(), set.lower_bound(key)));
+        ASSERT_EQ(tree.contains(key), set.contains(key));
+        auto it = tree.lower_bound(key);
+        if (set.lower_bound(key) == set.end())
+            ASSERT_EQ(it, tree.end());
+        else
+            ASSERT_EQ(*it, *set.lower_bound(key));
+    }
+
+    ASSERT_EQ(tree.get_num_elems_from_diapason(100, 2000),
+              std::distance(set.lower_bound(100), set.upper_bound(2000)));
+    ASSERT_EQ(tree.select(10), *std::next(set.begin(), 10));
+}
+
+TEST(TREE_TESTS, compact_tree_layout) {
+    static_assert(trees::CompactAVLtree<int>::node_size <= 20);
+    static_assert(std::is_same_v<trees::basic_tree<int, std::less<int>,
+                                                   trees::layout::compact>,
+                                 trees::CompactAVLtree<int>>);
+
+    CountingResource resource;
+    {
+        trees::CompactAVLtree<int> tree{&resource};
+        for (int i = 0; i < 1000; i++)
+            tree.insert(i);
+
+        ASSERT_EQ(tree.get_num_elems_from_diapason(5, 48), 44);
+        ASSERT_EQ(resource.bytes_in_use, tree.memory_usage());
+        ASSERT_LE(tree.memory_usage(), 2048 * trees::CompactAVLtree<int>::node_size);
+    }
+    ASSERT_EQ(resource.bytes_in_use, 0);
+}
+
+TEST(TREE_TESTS, insert_keeps_balance) {
+    trees::AVLtree<int> ascending;
+    trees::AVLtree<int> descending;
+    trees::AVLtree<int> mixed;
+    for (int i = 0; i < 4096; i++) {
+        ascending.insert(i);
+        descending.insert(-i);
+        mixed.insert((i * 2654435761U) % 100000);
+    }
+
+    ASSERT_EQ(ascending.height(), 13);
+    ASSERT_EQ(descending.height(), 13);
+    ASSERT_LE(mixed.height(), 1.45 * std::log2(mixed.size() + 2));
+
+    ASSERT_EQ(*descending.begin(), -4095);
+    ASSERT_EQ(*(--descending.end()), 0);
+    ASSERT_EQ(*mixed.begin(), *mixed.nth(0));
+    ASSERT_EQ(*(--mixed.end()), *mixed.nth(mixed.size() - 1));
+    for (size_t k = 0; k < mixed.size(); k += 13)
+        ASSERT_EQ(mixed.rank(mixed.select(k)), k);
+}
+
+TEST(TREE_TESTS, insert_stats) {
+    static_assert(std::is_empty_v<trees::stats::None>);
+
+    trees::AVLtree<int, std::less<int>, trees::details::ArenaStorage,
+                   trees::aggregates::Count, trees::stats::Insert>
+        tree;
+    for (int i = 0; i < 1024; i++)
+        tree.insert(i);
+    tree.insert(0);
+
+    const auto &stats = tree.stats();
+    ASSERT_EQ(stats.inserts, 1024);
+    ASSERT_EQ(stats.rotations, 1024 - 11);
+    ASSERT_GE(stats.touched_nodes, stats.height_updates);
+    ASSERT_GE(stats.height_updates, stats.inserts);
+}
+
+TEST(TREE_TESTS, custom_compare) {
+    trees::AVLtree<int, std::greater<int>> tree;
+    for (int i = 0; i < 100; i++)
+        tree.insert(i);
+
+    ASSERT_EQ(*tree.begin(), 99);
+    ASSERT_EQ(tree.select(0), 99);
+    ASSERT_EQ(*tree.lower_bound(50), 50);
+    ASSERT_EQ(*tree.upper_bound(50), 49);
+    ASSERT_EQ(tree.get_num_elems_from_diapason(60, 40), 21);
+    ASSERT_EQ(tree.get_num_elems_from_diapason(40, 60), 0);
+    ASSERT_EQ(tree.erase(99), 1);
+    ASSERT_EQ(*tree.begin(), 98);
+}
+
+struct ModuloCompare {
+    int modulo;
+
+    bool operator()(int lhs, int rhs) const {
+        return lhs % modulo < rhs % modulo;
+    }
+};
+
+TEST(TREE_TESTS, stateful_compare) {
+    trees::AVLtree<int, ModuloCompare> tree{ModuloCompare{10}};
+    for (int i = 0; i < 100; i++)
+        tree.insert(i);
+
+    ASSERT_EQ(tree.size(), 10);
+    ASSERT_TRUE(tree.contains(1234));
+    ASSERT_EQ(tree.get_num_elems_from_diapason(13, 25), 3);
+
+    auto copy{tree};
+    copy.insert(7);
+    ASSERT_EQ(copy.size(), 10);
+    ASSERT_EQ(copy.key_comp().modulo, 10);
+
+    std::vector<int> keys{15, 5, 25, 3};
+    trees::AVLtree<int, ModuloCompare> built(keys.begin(), keys.end(),
+                                             ModuloCompare{10});
+    ASSERT_EQ(built.size(), 2);
+}
+
+TEST(TREE_TESTS, empty_compare_takes_no_space) {
+    struct Less {
+        bool operator()(int lhs, int rhs) const { return lhs < rhs; }
+    };
+
+    ASSERT_EQ(sizeof(trees::AVLtree<int, Less>), sizeof(trees::AVLtree<int>));
+    ASSERT_LT(sizeof(trees::AVLtree<int>), sizeof(trees::AVLtree<int, ModuloCompare>));
+}
+
+TEST(TREE_TESTS, transparent_lookup) {
+    trees::AVLtree<std::string, std::less<>> tree;
+    for (int i = 0; i < 100; i++)
+        tree.insert("key" + std::to_string(i));
+
+    std::string_view key = "key42";
+    ASSERT_TRUE(tree.contains(key));
+    ASSERT_EQ(*tree.find(key), "key42");
+    ASSERT_EQ(*tree.lower_bound(std::string_view{"key420"}), "key43");
+    ASSERT_EQ(tree.rank(std::string_view{"key1"}), 1);
+    ASSERT_EQ(tree.get_num_elems_from_diapason(std::string_view{"key1"},
+                                               std::string_view{"key2"}),
+              12);
+    ASSERT_EQ(tree.erase(key), 1);
+    ASSERT_FALSE(tree.contains("key42"));
+}
+
+TEST(TREE_TESTS, count_ranges) {
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < 3000; i++)
+        tree.insert((i * 7919) % 5003);
+
+    std::vector<std::pair<int, int>> ranges;
+    for (int i = 0; i < 1000; i++) {
+        int lo = (i * 104729) % 5100 - 50;
+        ranges.emplace_back(lo, lo + i % 300);
+    }
+    ranges.emplace_back(10, 5);
+    ranges.emplace_back(-100, -1);
+    ranges.emplace_back(7, 7);
+    ranges.emplace_back(-100, 10000);
+
+    auto answers = tree.count_ranges(ranges);
+    ASSERT_EQ(answers.size(), ranges.size());
+    for (size_t i = 0; i < ranges.size(); i++)
+        ASSERT_EQ(answers[i], tree.get_num_elems_from_diapason(
+                                  ranges[i].first, ranges[i].second));
+
+    trees::AVLtree<int> empty;
+    ASSERT_EQ(empty.count_ranges(ranges), std::vector<size_t>(ranges.size()));
+}
+
+TEST(TREE_TESTS, get_answers_batches_requests) {
+    std::istringstream in("k 5 k 1 q 0 10 q 1 1 q 2 4 k 3 q 0 3 d 1 q 0 3 q 6 2\n");
+    std::vector<query::Query<int>> queries;
+    ASSERT_TRUE(query::process_input<int>(queries, in));
+
+    trees::AVLtree<int> tree;
+    auto answers = query::get_answers<int>(tree, queries.begin(), queries.end(),
+                                           query::RangeCount{});
+    ASSERT_EQ(answers, (std::vector<size_t>{2, 1, 0, 2, 1, 0}));
+
+    std::string commands;
+    for (int i = 0; i < 100; i++) {
+        commands += "k " + std::to_string(i * 37 % 101) + "\n";
+        if (i % 10 == 9)
+            for (int j = 0; j < 40; j++)
+                commands += "q " + std::to_string(j) + " " +
+                            std::to_string(j * 3) + "\n";
+    }
+
+    std::istringstream long_in(commands);
+    queries.clear();
+    ASSERT_TRUE(query::process_input<int>(queries, long_in));
+
+    trees::AVLtree<int> tree1;
+    trees::AVLtree<int> tree2;
+    auto batched = query::get_answers<int>(tree1, queries.begin(), queries.end(),
+                                           query::RangeCount{});
+    auto single = query::get_answers<int>(
+        tree2, queries.begin(), queries.end(),
+        [](trees::AVLtree<int> &tree, int key1, int key2) {
+            return tree.get_num_elems_from_diapason(key1, key2);
+        });
+    ASSERT_EQ(batched.size(), 400);
+    ASSERT_EQ(batched, single);
+}
+
+TEST(TREE_TESTS, fast_parser) {
+    auto commands = query::parse_commands<int>("k 5\nk -1\nq 0 10\n d 5 q -3 7");
+    ASSERT_EQ(commands.size(), 5);
+    ASSERT_EQ(commands.keys(), (std::vector<int>{5, -1, 0, 10, 5, -3, 7}));
+
+    std::vector<query::Query<int>> queries(commands.begin(), commands.end());
+    ASSERT_EQ(std::get<query::Key<int>>(queries[1]).key_, -1);
+    ASSERT_EQ(std::get<query::Request<int>>(queries[2]).key2_, 10);
+    ASSERT_EQ(std::get<query::Erase<int>>(queries[3]).key_, 5);
+    ASSERT_EQ(std::get<query::Request<int>>(queries[4]).key1_, -3);
+
+    trees::AVLtree<int> tree;
+    auto answers = query::get_answers<int>(tree, commands.begin(),
+                                           commands.end(), query::RangeCount{});
+    ASSERT_EQ(answers, (std::vector<size_t>{1, 1}));
+}
+
+TEST(TREE_TESTS, fast_parser_errors) {
+    auto offset_of = [](std::string_view text) -> size_t {
+        try {
+            query::parse_commands<int>(text);
+        } catch (query::parse_error &ex) {
+            return ex.offset();
+        }
+        return std::string_view::npos;
+    };
+
+    ASSERT_EQ(offset_of("k 1\nq 2 3\n"), std::string_view::npos);
+    ASSERT_EQ(offset_of("k 1\nx 2\n"), 4);
+    ASSERT_EQ(offset_of("k 1\nq 2 3a\n"), 8);
+    ASSERT_EQ(offset_of("k 1\nq 2"), 7);
+    ASSERT_EQ(offset_of("k 99999999999\n"), 2);
+    ASSERT_EQ(offset_of("k\nk 1"), 2);
+}
+
+TEST(TREE_TESTS, stream_queries) {
+    std::string commands;
+    for (int i = 0; i < 300; i++) {
+        commands += "k " + std::to_string(i * 37 % 301 - 150) + "\n";
+        if (i % 7 == 0)
+            commands += "d " + std::to_string(i % 50 - 25) + "\n";
+        for (int j = 0; j < i % 30; j++)
+            commands += "q " + std::to_string(j - 100) + " " +
+                        std::to_string(j * 5) + "\n";
+    }
+
+    trees::AVLtree<int> expected_tree;
+    auto parsed = query::parse_commands<int>(commands);
+    auto answers = query::get_answers<int>(expected_tree, parsed.begin(),
+                                           parsed.end(), query::RangeCount{});
+    std::string expected;
+    for (size_t answer : answers)
+        expected += std::to_string(answer) + " ";
+    expected += "\n";
+
+    for (size_t buffer_size : {16, 17, 100, 4096}) {
+        std::istringstream in(commands);
+        std::ostringstream out;
+        query::AnswerWriter writer{out, query::OutputFormat::text, 32};
+        trees::AVLtree<int> tree;
+        query::process_stream<int>(tree, query::StreamReader{in}, writer,
+                                   query::RangeCount{}, buffer_size);
+        ASSERT_EQ(out.str(), expected);
+    }
+}
+
+TEST(TREE_TESTS, stream_queries_errors) {
+    auto offset_of = [](const std::string &text, size_t buffer_size) -> size_t {
+        std::istringstream in(text);
+        std::ostringstream out;
+        query::AnswerWriter writer{out};
+        trees::AVLtree<int> tree;
+        try {
+            query::process_stream<int>(tree, query::StreamReader{in}, writer,
+                                       query::RangeCount{}, buffer_size);
+        } catch (query::parse_error &ex) {
+            return ex.offset();
+        }
+        return std::string::npos;
+    };
+
+    ASSERT_EQ(offset_of("k 1\nk 2\nq 0 5\n", 8), std::string::npos);
+    ASSERT_EQ(offset_of("k 1\nk 2\nx 3\n", 8), 8);
+    ASSERT_EQ(offset_of("k 1\nk 2\nq 0 5a\n", 8), 12);
+    ASSERT_EQ(offset_of("k 1\nq 100000 200000\n", 8), 4);
+}
+
+TEST(TREE_TESTS, answer_writer) {
+    std::vector<size_t> answers{0, 7, 42, 1000000, SIZE_MAX};
+
+    std::ostringstream text;
+    {
+        query::AnswerWriter writer{text, query::OutputFormat::text, 8};
+        query::print_answers(answers, writer);
+        writer.put(5);
+    }
+    ASSERT_EQ(text.str(), "0 7 42 1000000 " + std::to_string(SIZE_MAX) + " \n5 ");
+
+    std::ostringstream binary;
+    {
+        query::AnswerWriter writer{binary, query::OutputFormat::binary, 8};
+        query::print_answers(answers, writer);
+    }
+    std::string bytes = binary.str();
+    ASSERT_EQ(bytes.size(), answers.size() * sizeof(std::uint64_t));
+    for (size_t i = 0; i < answers.size(); i++) {
+        std::uint64_t value = 0;
+        std::memcpy(&value, bytes.data() + i * sizeof(value), sizeof(value));
+        ASSERT_EQ(value, answers[i]);
+    }
+}
+
+TEST(TREE_TESTS, concurrent_tree_matches_set) {
+    trees::ConcurrentAVLtree<int> tree;
+    std::set<int> set;
+
+    for (int i = 0; i < 3000; i++) {
+        int key = (i * 7919) % 1009;
+        if (i % 3 == 2)
+            ASSERT_EQ(tree.erase(key), set.erase(key));
+        else
+            ASSERT_EQ(tree.insert(key), set.insert(key).second);
+    }
+
+    ASSERT_EQ(tree.size(), set.size());
+    ASSERT_LE(tree.height(), 1.45 * std::log2(set.size() + 2));
+    for (int key = -5; key < 1020; key += 3) {
+        ASSERT_EQ(tree.contains(key), set.contains(key));
+        ASSERT_EQ(tree.rank(key),
+                  std::distance(set.begin(), set.lower_bound(key)));
+        ASSERT_EQ(tree.get_num_elems_from_diapason(key, key + 40),
+                  std::distance(set.lower_bound(key),
+                                set.upper_bound(key + 40)));
+    }
+}
+
+TEST(TREE_TESTS, concurrent_tree_readers_and_writer) {
+    const int num_keys = 20000;
+    trees::ConcurrentAVLtree<int> tree;
+    std::atomic<bool> done = false;
+    std::atomic<bool> failed = false;
+
+    // Keys [0, num_keys) are inserted and [num_keys, 2 * num_keys) erased
+    // while the readers run; 0 is there from the start.
+    tree.insert(0);
+    for (int i = num_keys; i < 2 * num_keys; i++)
+        tree.insert(i);
+
+    auto reader = [&] {
+        size_t last_inserted = 0;
+        size_t last_erased = num_keys;
+        while (!done.load()) {
+            size_t inserted = tree.get_num_elems_from_diapason(0, num_keys - 1);
+            size_t erased =
+                tree.get_num_elems_from_diapason(num_keys, 2 * num_keys - 1);
+            if (!tree.contains(0) || inserted < last_inserted ||
+                inserted > static_cast<size_t>(num_keys) ||
+                erased > last_erased)
+                failed = true;
+            last_inserted = inserted;
+            last_erased = erased;
+        }
+    };
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++)
+        readers.emplace_back(reader);
+
+    for (int i = 1; i < num_keys; i++) {
+        tree.insert(i);
+        if (tree.erase(num_keys + i) != 1)
+            failed = true;
+    }
+    done = true;
+
+    for (auto &thread : readers)
+        thread.join();
+
+    ASSERT_FALSE(failed.load());
+    ASSERT_EQ(tree.size(), num_keys + 1);
+    ASSERT_TRUE(tree.contains(num_keys));
+    ASSERT_FALSE(tree.contains(num_keys + 1));
+}
+
+TEST(TREE_TESTS, persistent_snapshots) {
+    CountingResource resource;
+    {
+        trees::PersistentAVLtree<int> tree{&resource};
+        std::set<int> set;
+        for (int i = 0; i < 1000; i++) {
+            tree.insert(i * 3 % 1000);
+            set.insert(i * 3 % 1000);
+        }
+
+        auto before = tree.snapshot();
+        auto before_set = set;
+        size_t bytes = resource.bytes_in_use;
+
+        for (int i = 0; i < 1000; i += 2) {
+            ASSERT_EQ(tree.erase(i), set.erase(i));
+            ASSERT_EQ(tree.insert(1000 + i), set.insert(1000 + i).second);
+        }
+        ASSERT_LT(resource.bytes_in_use - bytes, bytes * 2);
+
+        auto after = tree.snapshot();
+        ASSERT_EQ(before.size(), before_set.size());
+        ASSERT_EQ(after.size(), set.size());
+        ASSERT_LE(after.height(), 1.45 * std::log2(set.size() + 2));
+
+        for (int key = -3; key < 2100; key += 7) {
+            ASSERT_EQ(before.contains(key), before_set.contains(key));
+            ASSERT_EQ(after.contains(key), set.contains(key));
+            ASSERT_EQ(before.get_num_elems_from_diapason(key, key + 100),
+                      std::distance(before_set.lower_bound(key),
+                                    before_set.upper_bound(key + 100)));
+            ASSERT_EQ(tree.get_num_elems_from_diapason(key, key + 100),
+                      std::distance(set.lower_bound(key),
+                                    set.upper_bound(key + 100)));
+        }
+        ASSERT_EQ(before.select(10), 10);
+        ASSERT_EQ(after.select(0), 1);
+        ASSERT_EQ(tree.rank(1001), set.size() / 2 + 1);
+
+        auto copy = tree;
+        copy.insert(-1);
+        ASSERT_FALSE(tree.contains(-1));
+
+        tree = trees::PersistentAVLtree<int>{&resource};
+        ASSERT_EQ(before.size(), 1000);
+        ASSERT_TRUE(after.contains(1998));
+    }
+    ASSERT_EQ(resource.bytes_in_use, 0);
+}
+
+TEST(TREE_TESTS, thread_pool_parallel_for) {
+    query::ThreadPool pool{4};
+    ASSERT_EQ(pool.size(), 4);
+
+    for (size_t count : {0, 1, 5, 1000, 10007}) {
+        std::vector<std::atomic<int>> visits(count);
+        pool.parallel_for(count, 10, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++)
+                visits[i]++;
+        });
+        for (auto &visit : visits)
+            ASSERT_EQ(visit.load(), 1);
+    }
+
+    ASSERT_THROW(pool.parallel_for(1000, 1,
+                                   [](size_t first, size_t) {
+                                       if (first > 0)
+                                           throw std::runtime_error("chunk");
+                                   }),
+                 std::runtime_error);
+}
+
+TEST(TREE_TESTS, parallel_get_answers) {
+    std::string commands;
+    for (int i = 0; i < 50; i++) {
+        commands += "k " + std::to_string(i * 7919 % 1000) + "\n";
+        if (i % 10 == 9)
+            commands += "d " + std::to_string(i * 7919 % 1000) + "\n";
+        int run = i % 5 == 0 ? 3000 : 3;
+        for (int j = 0; j < run; j++)
+            commands += "q " + std::to_string(j % 997) + " " +
+                        std::to_string(j % 997 + i * 5) + "\n";
+    }
+    auto parsed = query::parse_commands<int>(commands);
+
+    trees::AVLtree<int> tree1;
+    auto expected = query::get_answers<int>(tree1, parsed.begin(),
+                                            parsed.end(), query::RangeCount{});
+
+    for (size_t threads : {1, 3, 8}) {
+        query::ThreadPool pool{threads};
+        trees::AVLtree<int> tree2;
+        auto answers = query::get_answers_parallel<int>(
+            tree2, parsed.begin(), parsed.end(), query::RangeCount{}, pool);
+        ASSERT_EQ(answers, expected);
+    }
+}
+
+template <typename TreeT>
+void expect_same_keys(const TreeT &tree, const std::set<int> &set) {
+    ASSERT_EQ(tree.size(), set.size());
+    ASSERT_TRUE(std::equal(tree.begin(), tree.end(), set.begin(), set.end()));
+    ASSERT_LE(tree.height(), 1.45 * std::log2(set.size() + 2));
+
+    size_t index = 0;
+    for (auto key : set) {
+        ASSERT_EQ(tree.rank(key), index);
+        ASSERT_EQ(tree.select(index), key);
+        index++;
+    }
+
+    if (!set.empty()) {
+        ASSERT_EQ(*std::prev(tree.end()), *set.rbegin());
+        ASSERT_EQ(tree.front(), *set.begin());
+    }
+}
+
+TEST(TREE_TESTS, split_and_join) {
+    std::set<int> set;
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < 2000; i++) {
+        tree.insert(i * 7919 % 4001);
+        set.insert(i * 7919 % 4001);
+    }
+
+    for (int key : {-5, 0, 1, 1234, 2000, 4000, 5000}) {
+        trees::AVLtree<int> left{tree};
+        auto right = left.split(key);
+
+        std::set<int> left_set{set.begin(), set.lower_bound(key)};
+        std::set<int> right_set{set.lower_bound(key), set.end()};
+        expect_same_keys(left, left_set);
+        expect_same_keys(right, right_set);
+
+        if (set.contains(key)) {
+            right.erase(key);
+            right_set.erase(key);
+            auto joined =
+                trees::AVLtree<int>::join(std::move(left), key, std::move(right));
+            expect_same_keys(joined, set);
+        }
+    }
+
+    std::vector<int> small_keys{1, 2, 3};
+    trees::AVLtree<int> small{small_keys.begin(), small_keys.end()};
+    trees::AVLtree<int> large{tree};
+    ASSERT_THROW(trees::AVLtree<int>::join(small, 2, large),
+                 std::invalid_argument);
+    auto joined = trees::AVLtree<int>::join(std::move(small), 5000,
+                                            large.split(5001));
+    ASSERT_EQ(joined.size(), 4);
+    ASSERT_EQ(joined.back(), 5000);
+}
+
+TEST(TREE_TESTS, merge_and_extract_range) {
+    CountingResource resource;
+    {
+        trees::AVLtree<int> first{&resource};
+        trees::AVLtree<int> second{&resource};
+        std::set<int> first_set;
+        std::set<int> second_set;
+        for (int i = 0; i < 3000; i++) {
+            first.insert(i * 3);
+            first_set.insert(i * 3);
+            second.insert(i * 5 % 7000);
+            second_set.insert(i * 5 % 7000);
+        }
+
+        auto range = first.extract_range(300, 4500);
+        std::set<int> range_set{first_set.lower_bound(300),
+                                first_set.upper_bound(4500)};
+        first_set.erase(first_set.lower_bound(300),
+                        first_set.upper_bound(4500));
+        expect_same_keys(first, first_set);
+        expect_same_keys(range, range_set);
+
+        second.merge(range);
+        second_set.insert(range_set.begin(), range_set.end());
+        expect_same_keys(second, second_set);
+        ASSERT_TRUE(range.empty());
+
+        second.splice(first, 4600, 100000);
+        second_set.insert(first_set.lower_bound(4600), first_set.end());
+        first_set.erase(first_set.lower_bound(4600), first_set.end());
+        expect_same_keys(first, first_set);
+        expect_same_keys(second, second_set);
+
+        auto upper = second.split(7000);
+        first.merge(upper);
+        first_set.insert(second_set.lower_bound(7000), second_set.end());
+        second_set.erase(second_set.lower_bound(7000), second_set.end());
+        expect_same_keys(first, first_set);
+        expect_same_keys(second, second_set);
+
+        trees::AVLtree<int, std::less<int>, trees::details::HeapStorage> heap;
+        trees::AVLtree<int, std::less<int>, trees::details::HeapStorage>
+            other_heap{&resource};
+        heap.insert(1);
+        other_heap.insert(1);
+        other_heap.insert(2);
+        heap.merge(other_heap);
+        ASSERT_EQ(heap.size(), 2);
+        ASSERT_TRUE(other_heap.empty());
+    }
+    ASSERT_EQ(resource.bytes_in_use, 0);
+}
+
+TEST(TREE_TESTS, move_small_ranges_out_of_big_trees) {
+    CountingResource resource;
+    {
+        trees::AVLtree<int> shard{&resource};
+        for (int i = 0; i < 100; i++) {
+            trees::AVLtree<int> big{&resource};
+            for (int key = 0; key < 10000; key++)
+                big.insert(key);
+
+            auto moved = big.extract_range(i, i);
+            shard.merge(moved);
+        }
+        ASSERT_EQ(shard.size(), 100);
+        ASSERT_LT(resource.bytes_in_use, 64 * 1024);
+
+        trees::AVLtree<int> big{&resource};
+        for (int key = 0; key < 10000; key++)
+            big.insert(key);
+        size_t allocations = resource.allocations;
+        auto upper = big.split(5000);
+        big.merge(upper);
+        ASSERT_EQ(resource.allocations, allocations);
+        ASSERT_EQ(big.size(), 10000);
+    }
+    ASSERT_EQ(resource.bytes_in_use, 0);
+}
+
+// Fails the allocation with number fail_at.
+struct FailingResource : std::pmr::memory_resource {
+    size_t allocations = 0;
+    size_t bytes_in_use = 0;
+    size_t fail_at = std::numeric_limits<size_t>::max();
+
+private:
+    void *do_allocate(size_t bytes, size_t align) override {
+        if (++allocations == fail_at)
+            throw std::bad_alloc{};
+        bytes_in_use += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, align);
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t align) override {
+        bytes_in_use -= bytes;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override {
+        return this == &other;
+    }
+};
+
+TEST(TREE_TESTS, merge_keeps_keys_when_allocation_fails) {
+    std::set<std::string> keys;
+    trees::AVLtree<std::string> other;
+    for (int i = 0; i < 500; i++) {
+        keys.insert(std::string(40, 'k') + std::to_string(i));
+        other.insert(std::string(40, 'k') + std::to_string(i));
+    }
+
+    FailingResource failing;
+    trees::AVLtree<std::string> tree{&failing};
+    tree.insert(std::string(40, 'a'));
+    keys.insert(std::string(40, 'a'));
+    failing.fail_at = failing.allocations + 1;
+
+    ASSERT_THROW(tree.merge(other), std::bad_alloc);
+    ASSERT_FALSE(tree.empty());
+    ASSERT_FALSE(other.empty());
+    ASSERT_EQ(tree.size() + other.size(), keys.size());
+    ASSERT_TRUE(std::is_sorted(tree.begin(), tree.end()));
+    ASSERT_TRUE(std::is_sorted(other.begin(), other.end()));
+
+    std::set<std::string> held{tree.begin(), tree.end()};
+    held.insert(other.begin(), other.end());
+    ASSERT_EQ(held, keys);
+
+    failing.fail_at = std::numeric_limits<size_t>::max();
+    tree.merge(other);
+    ASSERT_TRUE(other.empty());
+    ASSERT_TRUE(std::equal(tree.begin(), tree.end(), keys.begin(), keys.end()));
+}
+
+struct UnsharedResource : CountingResource {
+private:
+    bool do_is_equal(const std::pmr::memory_resource &) const
+        noexcept override {
+        return false;
+    }
+};
+
+TEST(TREE_TESTS, move_keys_across_resources) {
+    CountingResource resource;
+    {
+        trees::AVLtree<int> tree{&resource};
+        std::set<int> set;
+        for (int i = 0; i < 1000; i += 2) {
+            tree.insert(i);
+            set.insert(i);
+        }
+
+        {
+            std::pmr::monotonic_buffer_resource scoped;
+            trees::AVLtree<int> odd{&scoped};
+            for (int i = 1; i < 1000; i += 2) {
+                odd.insert(i);
+                set.insert(i);
+            }
+            tree.merge(odd);
+            ASSERT_TRUE(odd.empty());
+
+            trees::AVLtree<int> more{&scoped};
+            for (int i = 1000; i < 2000; i++)
+                more.insert(i);
+            tree.splice(more, 1000, 1499);
+            for (int i = 1000; i < 1500; i++)
+                set.insert(i);
+            ASSERT_EQ(more.size(), 500);
+
+            trees::AVLtree<int> upper{&scoped};
+            upper.insert(3000);
+            tree = trees::AVLtree<int>::join(std::move(tree), 2500,
+                                             std::move(upper));
+            set.insert(2500);
+            set.insert(3000);
+        }
+        expect_same_keys(tree, set);
+    }
+    ASSERT_EQ(resource.bytes_in_use, 0);
+
+    UnsharedResource unshared;
+    {
+        trees::AVLtree<int> tree{&unshared};
+        std::set<int> set;
+        for (int i = 0; i < 1000; i++) {
+            tree.insert(i * 7 % 1000);
+            set.insert(i);
+        }
+
+        auto upper = tree.split(600);
+        expect_same_keys(upper, {set.lower_bound(600), set.end()});
+        auto middle = tree.extract_range(200, 399);
+        expect_same_keys(middle, {set.lower_bound(200), set.lower_bound(400)});
+
+        tree.merge(upper);
+        tree.merge(middle);
+        expect_same_keys(tree, set);
+    }
+    ASSERT_EQ(unshared.bytes_in_use, 0);
+}
+
+namespace {
+// The last digits of the keys read as one decimal number, modulo 2^64. Not
+// commutative, so it also checks that aggregate keeps key order.
+struct Digits final {
+    struct value_type {
+        unsigned long long number = 0;
+        unsigned long long scale = 1;
+
+        bool operator==(const value_type &) const = default;
+    };
+
+    static value_type identity() noexcept { return {}; }
+
+    static value_type lift(int key) noexcept {
+        return {static_cast<unsigned long long>(key % 10), 10};
+    }
+
+    static value_type combine(const value_type &lhs,
+                              const value_type &rhs) noexcept {
+        return {lhs.number * rhs.scale + rhs.number, lhs.scale * rhs.scale};
+    }
+};
+
+// Concatenating strings allocates, so it may throw while nodes rebalance.
+struct Concat final {
+    using value_type = std::string;
+
+    static std::string identity() { return {}; }
+
+    static std::string lift(int key) { return std::to_string(key); }
+
+    static std::string combine(const std::string &lhs, const std::string &rhs) {
+        return lhs + rhs;
+    }
+};
+
+static_assert(trees::tree_aggregate<Digits, int>);
+static_assert(!trees::tree_aggregate<Concat, int>);
+} // namespace
+
+TEST(TREE_TESTS, range_aggregates) {
+    using SumTree = trees::AVLtree<int, std::less<int>,
+                                   trees::details::ArenaStorage,
+                                   trees::aggregates::Sum<long long>>;
+    using MinTree = trees::AVLtree<int, std::less<int>,
+                                   trees::details::ArenaStorage,
+                                   trees::aggregates::Min<int>>;
+    using DigitsTree =
+        trees::AVLtree<int, std::less<int>, trees::details::ArenaStorage, Digits>;
+
+    SumTree sum;
+    MinTree min;
+    DigitsTree digits;
+    std::set<int> set;
+
+    for (int i = 0; i < 3000; i++) {
+        int key = i * 7919 % 2003;
+        if (i % 4 == 3) {
+            sum.erase(key);
+            min.erase(key);
+            digits.erase(key);
+            set.erase(key);
+        } else {
+            sum.insert(key);
+            min.insert(key);
+            digits.insert(key);
+            set.insert(key);
+        }
+    }
+
+    auto check = [&](const SumTree &sum_tree, const DigitsTree &digits_tree,
+                     const std::set<int> &keys) {
+        for (int lo = -10; lo < 2100; lo += 37) {
+            for (int width : {0, 5, 100, 3000}) {
+                long long expected_sum = 0;
+                auto expected_digits = Digits::identity();
+                for (auto it = keys.lower_bound(lo);
+                     it != keys.end() && *it <= lo + width; ++it) {
+                    expected_sum += *it;
+                    expected_digits = Digits::combine(expected_digits,
+                                                      Digits::lift(*it));
+                }
+                ASSERT_EQ(sum_tree.aggregate(lo, lo + width), expected_sum);
+                ASSERT_EQ(digits_tree.aggregate(lo, lo + width),
+                          expected_digits);
+            }
+        }
+    };
+
+    check(sum, digits, set);
+    ASSERT_EQ(min.aggregate(100, 200), *set.lower_bound(100));
+    ASSERT_EQ(min.aggregate(3000, 4000), std::numeric_limits<int>::max());
+    ASSERT_EQ(sum.aggregate(10, 5), 0);
+
+    auto upper_sum = sum.split(1000);
+    auto upper_digits = digits.split(1000);
+    check(upper_sum, upper_digits, std::set<int>{set.lower_bound(1000), set.end()});
+    sum.merge(upper_sum);
+    digits.merge(upper_digits);
+    check(sum, digits, set);
+
+    SumTree copy{sum};
+    std::vector<int> sorted(set.begin(), set.end());
+    SumTree built{sorted.begin(), sorted.end()};
+    ASSERT_EQ(copy.aggregate(0, 2002), built.aggregate(0, 2002));
+    ASSERT_EQ(built.aggregate(500, 600), sum.aggregate(500, 600));
+
+    trees::AVLtree<int> counted{sorted.begin(), sorted.end()};
+    ASSERT_EQ(counted.aggregate(100, 1500),
+              counted.get_num_elems_from_diapason(100, 1500));
+}
+
+TEST(TREE_TESTS, map_matches_std_map) {
+    trees::AVLmap<int, std::string> map;
+    std::map<int, std::string> expected;
+
+    for (int i = 0; i < 2000; i++) {
+        int key = i * 7919 % 1009;
+        std::string value = std::to_string(i);
+        switch (i % 5) {
+        case 0:
+            ASSERT_EQ(map.try_emplace(key, value).second,
+                      expected.try_emplace(key, value).second);
+            break;
+        case 1:
+            ASSERT_EQ(map.insert_or_assign(key, value).second,
+                      expected.insert_or_assign(key, value).second);
+            break;
+        case 2:
+            map[key] += value;
+            expected[key] += value;
+            break;
+        case 3:
+            ASSERT_EQ(map.emplace(key, value).second,
+                      expected.emplace(key, value).second);
+            break;
+        default:
+            ASSERT_EQ(map.erase(key), expected.erase(key));
+        }
+    }
+
+    ASSERT_EQ(map.size(), expected.size());
+    auto it = map.begin();
+    for (auto &[key, value] : expected) {
+        ASSERT_EQ(it->first, key);
+        ASSERT_EQ(it->second, value);
+        ++it;
+    }
+
+    ASSERT_EQ(map.rank(500), std::distance(expected.begin(),
+                                           expected.lower_bound(500)));
+    ASSERT_EQ(map.nth(10)->first, std::next(expected.begin(), 10)->first);
+    ASSERT_EQ(map.get_num_elems_from_diapason(100, 200),
+              std::distance(expected.lower_bound(100),
+                            expected.upper_bound(200)));
+    ASSERT_EQ(map.at(expected.begin()->first), expected.begin()->second);
+    ASSERT_THROW(map.at(5000), std::out_of_range);
+}
+
+TEST(TREE_TESTS, map_move_only_values) {
+    trees::AVLmap<std::string, std::unique_ptr<int>> map;
+
+    auto [it, inserted] = map.try_emplace("b", std::make_unique<int>(2));
+    ASSERT_TRUE(inserted);
+    ASSERT_EQ(*it->second, 2);
+
+    auto value = std::make_unique<int>(3);
+    ASSERT_FALSE(map.try_emplace("b", std::move(value)).second);
+    ASSERT_NE(value, nullptr);
+
+    map.insert_or_assign("b", std::move(value));
+    ASSERT_EQ(*map.at("b"), 3);
+
+    map.emplace("a", std::make_unique<int>(1));
+    map["c"] = std::make_unique<int>(4);
+
+    std::string keys;
+    int sum = 0;
+    for (auto &[key, ptr] : map) {
+        keys += key;
+        sum += *ptr;
+    }
+    ASSERT_EQ(keys, "abc");
+    ASSERT_EQ(sum, 8);
+
+    map.erase(map.find("a"));
+    ASSERT_EQ(map.size(), 2);
+    ASSERT_FALSE(map.contains("a"));
+}
+
+TEST(TREE_TESTS, multiset_counts_occurrences) {
+    trees::AVLmultiset<int> multiset;
+    std::multiset<int> expected;
+
+    for (int i = 0; i < 5000; i++) {
+        int key = i * 7919 % 101;
+        if (i % 7 == 3) {
+            auto it = expected.find(key);
+            ASSERT_EQ(multiset.erase_one(key), it != expected.end());
+            if (it != expected.end())
+                expected.erase(it);
+        } else if (i % 97 == 0) {
+            ASSERT_EQ(multiset.erase(key), expected.erase(key));
+        } else {
+            multiset.insert(key);
+            expected.insert(key);
+        }
+    }
+
+    ASSERT_EQ(multiset.size(), expected.size());
+    ASSERT_LE(multiset.distinct_size(), 101);
+    for (int key = -1; key <= 101; key++) {
+        ASSERT_EQ(multiset.count(key), expected.count(key));
+        ASSERT_EQ(multiset.rank(key),
+                  std::distance(expected.begin(), expected.lower_bound(key)));
+        ASSERT_EQ(multiset.get_num_elems_from_diapason(key, key + 10),
+                  std::distance(expected.lower_bound(key),
+                                expected.upper_bound(key + 10)));
+    }
+
+    size_t total = 0;
+    for (auto &entry : multiset)
+        total += entry.count();
+    ASSERT_EQ(total, expected.size());
+
+    multiset.insert(1000, 5);
+    ASSERT_EQ(multiset.count(1000), 5);
+    ASSERT_EQ(multiset.get_num_elems_from_diapason(999, 1001), 5);
+}
+
+TEST(TREE_TESTS, multiset_get_answers) {
+    std::vector<query::Query<int>> queries;
+    std::string_view input = "k 5 k 5 k 3 q 1 10 d 5 q 4 5 k 3 q 3 3 q 0 9\n";
+    std::istringstream in{std::string{input}};
+    ASSERT_TRUE(query::process_input<int>(queries, in));
+
+    trees::AVLmultiset<int> multiset;
+    auto answers = query::get_answers<int>(multiset, queries.begin(),
+                                           queries.end(), query::RangeCount{});
+    ASSERT_EQ(answers, (std::vector<size_t>{3, 1, 2, 3}));
+}
+
+TEST(TREE_TESTS, move_and_emplace_keys) {
+    using Tree = trees::AVLtree<std::string>;
+    static_assert(std::is_same_v<decltype(*std::declval<const Tree::iterator &>()),
+                                 const std::string &>);
+
+    Tree tree;
+    std::string key(40, 'b');
+    const char *buffer = key.data();
+
+    auto [it, inserted] = tree.insert(std::move(key));
+    ASSERT_TRUE(inserted);
+    ASSERT_EQ(it->data(), buffer);
+
+    ASSERT_TRUE(tree.emplace(40, 'a').second);
+    ASSERT_FALSE(tree.emplace(40, 'b').second);
+    ASSERT_EQ(tree.size(), 2);
+    ASSERT_EQ(tree.front(), std::string(40, 'a'));
+    ASSERT_EQ(&tree.back(), &*tree.find(std::string(40, 'b')));
+}
+
+TEST(TREE_TESTS, extract_and_insert_nodes) {
+    trees::AVLtree<std::string> tree;
+    for (int i = 0; i < 100; i++)
+        tree.insert(std::string(30, 'a') + std::to_string(i));
+
+    auto handle = tree.extract(std::string(30, 'a') + "42");
+    ASSERT_FALSE(handle.empty());
+    ASSERT_EQ(tree.size(), 99);
+    ASSERT_TRUE(tree.extract("missing").empty());
+
+    handle.key() = std::string(30, 'z');
+    const char *buffer = handle.key().data();
+
+    auto result = tree.insert(std::move(handle));
+    ASSERT_TRUE(result.inserted);
+    ASSERT_TRUE(result.node.empty());
+    ASSERT_EQ(result.position->data(), buffer);
+    ASSERT_EQ(tree.back(), std::string(30, 'z'));
+    ASSERT_EQ(tree.size(), 100);
+
+    auto duplicate = tree.extract(tree.begin());
+    tree.insert(*tree.begin() + "x");
+    duplicate.key() = *tree.begin();
+    auto rejected = tree.insert(std::move(duplicate));
+    ASSERT_FALSE(rejected.inserted);
+    ASSERT_FALSE(rejected.node.empty());
+    ASSERT_EQ(*rejected.position, rejected.node.key());
+
+    trees::AVLtree<std::string> other;
+    auto moved = other.insert(tree.extract(tree.begin()));
+    ASSERT_TRUE(moved.inserted);
+    tree.clear();
+    ASSERT_EQ(other.size(), 1);
+    ASSERT_EQ(other.front().substr(0, 30), std::string(30, 'a'));
+
+    std::pmr::monotonic_buffer_resource resource;
+    trees::AVLtree<std::string, std::less<std::string>,
+                   trees::details::HeapStorage>
+        heap_tree{&resource};
+    trees::AVLtree<std::string, std::less<std::string>,
+                   trees::details::HeapStorage>
+        default_heap_tree;
+    heap_tree.insert(std::string(30, 'q'));
+    auto copied = default_heap_tree.insert(heap_tree.extract(heap_tree.begin()));
+    ASSERT_TRUE(copied.inserted);
+    ASSERT_TRUE(heap_tree.empty());
+    ASSERT_EQ(default_heap_tree.front(), std::string(30, 'q'));
+
+    trees::AVLtree<std::string> arena_tree;
+    {
+        std::pmr::monotonic_buffer_resource scoped;
+        trees::AVLtree<std::string> scoped_tree{&scoped};
+        scoped_tree.insert(std::string(30, 'r'));
+        auto node = scoped_tree.extract(scoped_tree.begin());
+        const char *key_buffer = node.key().data();
+        auto result = arena_tree.insert(std::move(node));
+        ASSERT_TRUE(result.inserted);
+        ASSERT_EQ(result.position->data(), key_buffer);
+    }
+    ASSERT_EQ(arena_tree.size(), 1);
+    ASSERT_EQ(arena_tree.front(), std::string(30, 'r'));
+}
+
+TEST(TREE_TESTS, inserted_node_does_not_hold_its_tree) {
+    CountingResource resource;
+    trees::AVLtree<int> target{&resource};
+    {
+        trees::AVLtree<int> big{&resource};
+        for (int i = 0; i < 10000; i++)
+            big.insert(i);
+
+        target.insert(big.extract(big.find(42)));
+        auto upper = big.split(5000);
+        size_t allocations = resource.allocations;
+        big.insert(upper.extract(upper.begin()));
+        ASSERT_EQ(resource.allocations, allocations);
+    }
+    ASSERT_EQ(target.size(), 1);
+    ASSERT_EQ(target.front(), 42);
+    ASSERT_LT(resource.bytes_in_use, 16 * 1024);
+}
+
+TEST(TREE_TESTS, snapshot_save_load_and_map) {
+    auto path = std::filesystem::temp_directory_path() / "avl_tree_snapshot.bin";
+
+    std::vector<int> keys;
+    for (int i = 0; i < 10000; i++)
+        keys.push_back(i * 7919 % 20011 - 10000);
+    trees::AVLtree<int> tree{keys.begin(), keys.end()};
+    trees::save(tree, path);
+
+    auto loaded = trees::load<int>(path);
+    ASSERT_EQ(loaded.size(), tree.size());
+    ASSERT_TRUE(std::equal(loaded.begin(), loaded.end(), tree.begin()));
+
+    trees::MappedAVLtree<int> mapped{path};
+    ASSERT_EQ(mapped.size(), tree.size());
+    for (int lo = -10100; lo < 10100; lo += 97) {
+        ASSERT_EQ(mapped.get_num_elems_from_diapason(lo, lo + 500),
+                  tree.get_num_elems_from_diapason(lo, lo + 500));
+        ASSERT_EQ(mapped.rank(lo), tree.rank(lo));
+        ASSERT_EQ(mapped.contains(lo), tree.contains(lo));
+    }
+    ASSERT_EQ(mapped.select(1234), tree.select(1234));
+    ASSERT_EQ(mapped.get_num_elems_from_diapason(5, 1), 0);
+
+    trees::save(trees::AVLtree<int>{}, path);
+    trees::MappedAVLtree<int> empty{path};
+    ASSERT_TRUE(empty.empty());
+    ASSERT_EQ(empty.get_num_elems_from_diapason(0, 100), 0);
+
+    std::filesystem::remove(path);
+}
+
+TEST(TREE_TESTS, snapshot_rejects_bad_files) {
+    auto path = std::filesystem::temp_directory_path() / "avl_tree_bad.bin";
+
+    std::vector<int> keys(1000);
+    std::iota(keys.begin(), keys.end(), 0);
+    trees::save(trees::AVLtree<int>{keys.begin(), keys.end()}, path);
+
+    ASSERT_THROW(trees::MappedAVLtree<double>{path}, trees::snapshot_error);
+
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(100);
+        file.put('\x7f');
+    }
+    ASSERT_THROW(trees::load<int>(path), trees::snapshot_error);
+    ASSERT_NO_THROW(trees::MappedAVLtree<int>(path, false));
+
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << "k 1 k 2 q 1 2";
+    }
+    ASSERT_THROW(trees::MappedAVLtree<int>{path}, trees::snapshot_error);
+
+    std::filesystem::remove(path);
+    ASSERT_THROW(trees::MappedAVLtree<int>{path}, std::system_error);
+}
+
+TEST(TREE_TESTS, frozen_index_matches_tree) {
+    for (int size : {0, 1, 2, 15, 16, 17, 1000, 4097}) {
+        trees::AVLtree<int> tree;
+        for (int i = 0; i < size; i++)
+            tree.insert(i * 7919 % 10007 * 2);
+
+        auto index = trees::freeze(tree);
+        ASSERT_EQ(index.size(), tree.size());
+        for (int lo = -3; lo < 20020; lo += 13) {
+            ASSERT_EQ(index.rank(lo), tree.rank(lo));
+            ASSERT_EQ(index.contains(lo), tree.contains(lo));
+            ASSERT_EQ(index.get_num_elems_from_diapason(lo, lo + 40),
+                      tree.get_num_elems_from_diapason(lo, lo + 40));
+        }
+        ASSERT_EQ(index.get_num_elems_from_diapason(10, 2), 0);
+    }
+
+    std::vector<std::string> words = {"pear", "apple", "fig", "kiwi", "lime"};
+    trees::AVLtree<std::string, std::greater<>> reversed{words.begin(),
+                                                         words.end()};
+    auto index = trees::freeze(reversed);
+    ASSERT_EQ(index.get_num_elems_from_diapason("lime", "fig"), 3);
+    ASSERT_EQ(index.rank("kiwi"), 2);
+    ASSERT_FALSE(index.contains("plum"));
+
+    std::vector<int> sorted = {1, 3, 5, 7};
+    trees::FrozenIndex<int> from_range{sorted.begin(), sorted.end()};
+    ASSERT_EQ(from_range.get_num_elems_from_diapason(2, 7), 3);
+
+    // The keys are counted before they are read, so one pass is not enough.
+    static_assert(!std::is_constructible_v<trees::FrozenIndex<int>,
+                                           std::istream_iterator<int>,
+                                           std::istream_iterator<int>>);
+}
+
+TEST(TREE_TESTS, frozen_index_get_answers) {
+    std::vector<query::Query<int>> queries;
+    std::stringstream input{"k 10 k 20 k 30 k 40 q 15 35 q 5 100 q 40 40 "
+                            "q 41 50 q 30 10\n"};
+    ASSERT_TRUE(query::process_input(queries, input));
+
+    trees::AVLtree<int> tree;
+    auto split = std::find_if(queries.begin(), queries.end(), [](auto &q) {
+        return std::holds_alternative<query::Request<int>>(q);
+    });
+    for (auto it = queries.begin(); it != split; ++it)
+        tree.insert(std::get<query::Key<int>>(*it).key_);
+
+    auto index = trees::freeze(tree);
+    auto answers = query::get_answers<int>(tree, split, queries.end(),
+                                           query::IndexCount{index});
+    ASSERT_EQ(answers, (std::vector<size_t>{2, 4, 1, 0, 0}));
+
+    std::vector<std::pair<int, int>> ranges;
+    for (int i = 0; i < 100; i++)
+        ranges.emplace_back(i, i + 25);
+    ASSERT_EQ(index.count_ranges(ranges), tree.count_ranges(ranges));
+}
+
+template <typename KeyT> void check_packed_tree(const std::vector<KeyT> &keys) {
+    trees::PackedTree<KeyT> tree;
+    std::set<KeyT> set;
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (i % 3 == 2) {
+            ASSERT_EQ(tree.erase(keys[i / 2]), set.erase(keys[i / 2]));
+        } else {
+            ASSERT_EQ(tree.insert(keys[i]), set.insert(keys[i]).second);
+        }
+    }
+
+    ASSERT_EQ(tree.size(), set.size());
+    ASSERT_TRUE(std::equal(tree.begin(), tree.end(), set.begin(), set.end()));
+
+    for (size_t i = 0; i < keys.size(); i += 7) {
+        KeyT key = keys[i];
+        ASSERT_EQ(tree.rank(key), std::distance(set.begin(), set.lower_bound(key)));
+        ASSERT_EQ(tree.contains(key), set.contains(key));
+        ASSERT_EQ(tree.lower_bound(key) == tree.end(),
+                  set.lower_bound(key) == set.end());
+        if (set.lower_bound(key) != set.end()) {
+            ASSERT_EQ(*tree.lower_bound(key), *set.lower_bound(key));
+        }
+
+        KeyT hi = keys[(i * 31) % keys.size()];
+        ASSERT_EQ(tree.get_num_elems_from_diapason(key, hi),
+                  hi < key ? 0 : std::distance(set.lower_bound(key), set.upper_bound(hi)));
+    }
+
+    for (size_t k = 0; k < set.size(); k += 101)
+        ASSERT_EQ(tree.select(k), *std::next(set.begin(), k));
+
+    trees::PackedTree<KeyT> copy{tree};
+    for (auto key : set)
+        ASSERT_EQ(tree.erase(key), 1);
+    ASSERT_TRUE(tree.empty());
+    ASSERT_EQ(tree.memory_usage(), 0);
+    ASSERT_TRUE(std::equal(copy.begin(), copy.end(), set.begin(), set.end()));
+}
+
+TEST(TREE_TESTS, packed_tree_matches_set) {
+    std::vector<int> ints;
+    std::vector<unsigned> unsigneds;
+    std::vector<std::int64_t> longs;
+    std::vector<short> shorts;
+    unsigned state = 4242;
+    for (int i = 0; i < 8000; i++) {
+        state = state * 1103515245U + 12345U;
+        ints.push_back(static_cast<int>(state % 6000) - 3000);
+        unsigneds.push_back(state);
+        longs.push_back((static_cast<std::int64_t>(state) << 31) - (1LL << 61));
+        shorts.push_back(static_cast<short>(state >> 16));
+    }
+
+    for (auto level : {trees::simd::Level::scalar, trees::simd::Level::sse2,
+                       trees::simd::Level::avx2}) {
+        trees::simd::use(level);
+        check_packed_tree(ints);
+        check_packed_tree(unsigneds);
+        check_packed_tree(longs);
+        check_packed_tree(shorts);
+    }
+    trees::simd::use(trees::simd::detected());
+}
+
+TEST(TREE_TESTS, packed_tree_insert_survives_failed_allocation) {
+    for (size_t fail_at = 1; fail_at < 60; fail_at++) {
+        FailingResource resource;
+        resource.fail_at = fail_at;
+        {
+            trees::PackedTree<int> tree{&resource};
+            std::set<int> set;
+            for (int i = 0; i < 2000; i++) {
+                int key = i * 7919 % 2003;
+                try {
+                    tree.insert(key);
+                    set.insert(key);
+                } catch (std::bad_alloc &) {
+                }
+            }
+
+            ASSERT_EQ(tree.size(), set.size());
+            ASSERT_TRUE(std::equal(tree.begin(), tree.end(), set.begin(),
+                                   set.end()));
+            ASSERT_EQ(tree.get_num_elems_from_diapason(0, 2003), set.size());
+            ASSERT_EQ(resource.bytes_in_use, tree.memory_usage());
+        }
+        ASSERT_EQ(resource.bytes_in_use, 0);
+    }
+}
+
+TEST(TREE_TESTS, packed_tree_layout) {
+    static_assert(std::is_same_v<trees::basic_tree<int, std::less<int>,
+                                                   trees::layout::packed>,
+                                 trees::PackedTree<int>>);
+    static_assert(std::is_same_v<trees::basic_tree<double, std::less<double>,
+                                                   trees::layout::packed>,
+                                 trees::AVLtree<double>>);
+
+    CountingResource resource;
+    {
+        trees::PackedTree<int> tree{&resource};
+        for (int i = 0; i < 100000; i++)
+            tree.insert(i);
+
+        ASSERT_LE(tree.height(), 6);
+        ASSERT_EQ(resource.bytes_in_use, tree.memory_usage());
+        ASSERT_EQ(tree.get_num_elems_from_diapason(5, 48), 44);
+
+        auto queries = std::vector<query::Query<int>>{
+            query::Key<int>{-1}, query::Request<int>{-5, 10},
+            query::Erase<int>{3}, query::Request<int>{0, 99999}};
+        auto answers = query::get_answers<int>(tree, queries.begin(),
+                                               queries.end(), query::RangeCount{});
+        ASSERT_EQ(answers, (std::vector<size_t>{12, 99999}));
+    }
+    ASSERT_EQ(resource.bytes_in_use, 0);
+}
+
+TEST(TREE_TESTS, range_count_with_absent_bounds) {
+    std::set<int> set;
+    trees::AVLtree<int> tree;
+    for (int i = 0; i < 300; i++) {
+        set.insert(i * 3);
+        tree.insert(i * 3);
+    }
+
+    for (int lo = -5; lo < 905; lo += 2) {
+        for (int hi = lo - 3; hi < lo + 40; hi += 5) {
+            size_t expected =
+                hi < lo ? 0 : std::distance(set.lower_bound(lo), set.upper_bound(hi));
+            ASSERT_EQ(tree.get_num_elems_from_diapason(lo, hi), expected);
+        }
+    }
+
+    ASSERT_EQ(trees::AVLtree<int>{}.get_num_elems_from_diapason(0, 10), 0);
+    ASSERT_EQ(tree.get_num_elems_from_diapason(1000, 2000), 0);
+    ASSERT_EQ(tree.get_num_elems_from_diapason(-100, -1), 0);
+    ASSERT_EQ(tree.get_num_elems_from_diapason(-100, 10000), 300);
+}